@@ -0,0 +1,107 @@
+#include "alloc-tracker.h"
+
+#include <cstdlib>
+#include <new>
+#include "stats.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment( lib, "psapi.lib" )
+#else
+#include <sys/resource.h>
+#endif
+
+std::atomic<bool> AllocTracker::enabled_ = false;
+
+void AllocTracker::CountAllocation( size_t size )
+{
+	// Only touches counters that already exist, so this never allocates itself
+	FunctionStats* stats = FunctionStats::current();
+	if( !stats )
+		return;
+
+	stats->total_allocs.Add( size );
+	if( const PhaseTimer* timer = PhaseTimer::innermost() )
+		stats->allocs[(size_t)timer->phase()].Add( size );
+}
+
+size_t PeakRssBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if( !GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0;
+	// Kilobytes on Linux
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+static void* Allocate( size_t size )
+{
+	if( AllocTracker::enabled() )
+		AllocTracker::CountAllocation( size );
+	return malloc( size ? size : 1 );
+}
+
+void* operator new( size_t size )
+{
+	void* ptr = Allocate( size );
+	if( !ptr )
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[]( size_t size )
+{
+	void* ptr = Allocate( size );
+	if( !ptr )
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new( size_t size, const std::nothrow_t& ) noexcept
+{
+	return Allocate( size );
+}
+
+void* operator new[]( size_t size, const std::nothrow_t& ) noexcept
+{
+	return Allocate( size );
+}
+
+void operator delete( void* ptr ) noexcept
+{
+	free( ptr );
+}
+
+void operator delete[]( void* ptr ) noexcept
+{
+	free( ptr );
+}
+
+void operator delete( void* ptr, size_t ) noexcept
+{
+	free( ptr );
+}
+
+void operator delete[]( void* ptr, size_t ) noexcept
+{
+	free( ptr );
+}
+
+void operator delete( void* ptr, const std::nothrow_t& ) noexcept
+{
+	free( ptr );
+}
+
+void operator delete[]( void* ptr, const std::nothrow_t& ) noexcept
+{
+	free( ptr );
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Counts every allocation made through operator new into the stats of the function the thread is
+// working on, under the phase that is running. Off unless started, and while off the hooks only
+// check a flag before calling malloc.
+class AllocTracker
+{
+public:
+	static void Start() { enabled_.store( true, std::memory_order_release ); }
+	static bool enabled() { return enabled_.load( std::memory_order_acquire ); }
+
+	static void CountAllocation( size_t size );
+private:
+	static std::atomic<bool> enabled_;
+};
+
+// Most memory the process has had resident at once so far, 0 if the system can't tell
+size_t PeakRssBytes();
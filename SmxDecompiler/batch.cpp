@@ -0,0 +1,412 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include "output-sink.h"
+#include "alloc-tracker.h"
+
+namespace fs = std::filesystem;
+
+// How many items each queue of the pipeline holds per thread of the stage it feeds
+constexpr size_t PIPELINE_DEPTH_PER_THREAD = 4;
+
+// Memory a plugin takes while it is decompiled, per byte of the file on disk. Covers the
+// decompressed image and the IL of the function being worked on, which is freed after each
+// function.
+constexpr uintmax_t MEMORY_PER_PLUGIN_BYTE = 8;
+
+struct BatchItem
+{
+	fs::path input;
+	fs::path output;
+	size_t memory;
+};
+
+// Blocks new plugins from starting while the estimated memory of the ones in flight is too high.
+// A plugin is always let through when nothing else runs, so one that is over the limit by itself
+// still gets done.
+class MemoryBudget
+{
+public:
+	explicit MemoryBudget( size_t limit ) : limit_( limit ) {}
+
+	void Acquire( size_t amount )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		released_.wait( lock, [&] { return limit_ == 0 || in_use_ == 0 || in_use_ + amount <= limit_; } );
+		in_use_ += amount;
+	}
+	void Release( size_t amount )
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			in_use_ -= amount;
+		}
+		released_.notify_all();
+	}
+private:
+	size_t limit_;
+	size_t in_use_ = 0;
+	std::mutex mutex_;
+	std::condition_variable released_;
+};
+
+static void AddItem( const fs::path& input, const fs::path& output, std::vector<BatchItem>& items )
+{
+	std::error_code ec;
+	uintmax_t size = fs::file_size( input, ec );
+	if( ec )
+		size = 0;
+
+	BatchItem item;
+	item.input = input;
+	item.output = output;
+	item.output.replace_extension( ".sp" );
+	item.memory = (size_t)( size * MEMORY_PER_PLUGIN_BYTE );
+	items.push_back( std::move( item ) );
+}
+
+static bool CollectItems( const std::string& input, const fs::path& output_dir, std::vector<BatchItem>& items )
+{
+	if( !input.empty() && input[0] == '@' )
+	{
+		std::ifstream list( input.substr( 1 ) );
+		if( !list )
+		{
+			std::cerr << "Could not open file list " << input.substr( 1 ) << std::endl;
+			return false;
+		}
+
+		bool ok = true;
+		std::string line;
+		while( std::getline( list, line ) )
+		{
+			if( !line.empty() && line.back() == '\r' )
+				line.pop_back();
+			if( !line.empty() )
+				ok &= CollectItems( line, output_dir, items );
+		}
+		return ok;
+	}
+
+	fs::path path( input );
+	std::error_code ec;
+	if( fs::is_directory( path, ec ) )
+	{
+		// Sort so the order of the work doesn't depend on the file system
+		std::vector<fs::path> files;
+		for( const auto& entry : fs::recursive_directory_iterator( path, ec ) )
+		{
+			if( entry.is_regular_file() && entry.path().extension() == ".smx" )
+				files.push_back( entry.path() );
+		}
+		std::sort( files.begin(), files.end() );
+
+		for( const fs::path& file : files )
+			AddItem( file, output_dir / fs::relative( file, path ), items );
+		return true;
+	}
+
+	if( !fs::exists( path, ec ) )
+	{
+		std::cerr << "Could not open file " << input << std::endl;
+		return false;
+	}
+
+	AddItem( path, output_dir / path.filename(), items );
+	return true;
+}
+
+// Collects the plugins to decompile, biggest first so they don't hold up the end of the batch.
+// Returns the number of inputs that could not be found.
+static size_t CollectBatch( const std::vector<std::string>& inputs, const fs::path& output_dir, std::vector<BatchItem>& items )
+{
+	size_t num_failed = 0;
+	for( const std::string& input : inputs )
+	{
+		if( !CollectItems( input, output_dir, items ) )
+			num_failed++;
+	}
+
+	std::stable_sort( items.begin(), items.end(),
+		[]( const BatchItem& a, const BatchItem& b ) { return a.memory > b.memory; } );
+	return num_failed;
+}
+
+// Prints the errors of plugins as they come in, from any thread
+class FailureReport
+{
+public:
+	void operator()( const BatchItem& item, const std::string& error )
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		std::cerr << item.input.string() << ": " << error << std::endl;
+		num_failed_++;
+	}
+
+	size_t num_failed() const { return num_failed_; }
+private:
+	std::mutex mutex_;
+	size_t num_failed_ = 0;
+};
+
+// A plugin that is being decompiled, kept alive until its last function is written
+struct PluginJob
+{
+	std::unique_ptr<SmxFile> smx;
+	std::unique_ptr<OutputSink> sink;
+	std::unique_ptr<OutputBuffer> out;
+	PhaseTime load;
+	FileStats* stats = nullptr;
+};
+
+static bool OpenPlugin( const BatchItem& item, PluginJob& job, std::string& error )
+{
+	std::string path = item.input.string();
+	{
+		TraceSpan span( "phase", "load", path.c_str() );
+		Stopwatch watch;
+		watch.Start();
+		job.smx = std::make_unique<SmxFile>( path.c_str() );
+		job.load = watch.Elapsed();
+	}
+	if( job.smx->code_size() == 0 )
+	{
+		error = "not a valid plugin";
+		return false;
+	}
+
+	std::error_code ec;
+	fs::create_directories( item.output.parent_path(), ec );
+	job.sink = OutputSink::Open( item.output.string().c_str() );
+	if( !job.sink )
+	{
+		error = "could not open " + item.output.string();
+		return false;
+	}
+
+	job.out = std::make_unique<OutputBuffer>( *job.sink );
+	Tracer::AsyncBegin( "file", path, (uintptr_t)&item );
+	return true;
+}
+
+// Writes out the rest of a plugin whose functions are all done, then frees it
+static void ClosePlugin( const BatchItem& item, PluginJob& job, FailureReport& report )
+{
+	job.out->Flush();
+	if( job.sink->failed() )
+		report( item, "could not write " + item.output.string() );
+	if( job.stats && AllocTracker::enabled() )
+		job.stats->peak_rss = PeakRssBytes();
+
+	job.out.reset();
+	job.sink.reset();
+	job.smx.reset();
+	Tracer::AsyncEnd( "file", item.input.string(), (uintptr_t)&item );
+}
+
+size_t RunBatch( const std::vector<std::string>& inputs, const DecompileOptions& options, const BatchOptions& batch,
+	TaskScheduler& scheduler )
+{
+	std::vector<BatchItem> items;
+	size_t num_failed = CollectBatch( inputs, batch.output_dir, items );
+
+	FailureReport report;
+	MemoryBudget budget( batch.memory_limit );
+	for( size_t i = 0; i < items.size(); i++ )
+	{
+		budget.Acquire( items[i].memory );
+
+		// Loading a plugin only queues up its functions, so it goes before any function. How
+		// many plugins are open at once is up to the memory budget.
+		scheduler.Submit( std::numeric_limits<uint64_t>::max(), [&, i] {
+			const BatchItem& item = items[i];
+			auto job = std::make_shared<PluginJob>();
+			std::string error;
+			if( !OpenPlugin( item, *job, error ) )
+			{
+				report( item, error );
+				budget.Release( item.memory );
+				return;
+			}
+
+			DecompileOptions file_options = options;
+			if( batch.stats )
+				file_options.stats = job->stats = &batch.stats->AddFile( item.input.string(), job->load );
+
+			DecompileFileAsync( *job->smx, file_options, *job->out, scheduler, [&, job, i] {
+				// Close the file and free the plugin before letting the next one in
+				ClosePlugin( items[i], *job, report );
+				budget.Release( items[i].memory );
+			} );
+		} );
+	}
+	scheduler.WaitAll();
+
+	return num_failed + report.num_failed();
+}
+
+// A plugin in the pipeline. Its functions hold on to it, so it lives until the last one is written.
+struct PipelinePlugin
+{
+	const BatchItem* item;
+	PluginJob job;
+	std::vector<SmxFunction*> funcs;
+	std::unique_ptr<OrderedOutput> output;
+};
+
+// A function on its way through the pipeline. Every stage may run on a different thread, so each
+// one puts the pool of the function in use while it creates nodes.
+struct FunctionWork
+{
+	std::shared_ptr<PipelinePlugin> plugin;
+	size_t index = 0;
+	FunctionStats* stats = nullptr;
+
+	// Freed in reverse order, the graph and the statements point into the nodes
+	ILNodePool nodes;
+	std::unique_ptr<OutputBuffer> code;
+	std::unique_ptr<ILControlFlowGraph> ilcfg;
+	std::unique_ptr<Structurizer> structurizer;
+	Statement* func_stmt = nullptr;
+
+	SmxFile& smx() { return *plugin->job.smx; }
+	SmxFunction& func() { return *plugin->funcs[index]; }
+};
+
+using WorkQueue = BoundedQueue<std::unique_ptr<FunctionWork>>;
+using WorkStage = PipelineStage<std::unique_ptr<FunctionWork>>;
+
+size_t RunBatchPipeline( const std::vector<std::string>& inputs, const DecompileOptions& options, const BatchOptions& batch,
+	size_t num_threads, PipelineStats* stats )
+{
+	if( num_threads == 0 )
+		num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+	std::vector<BatchItem> items;
+	size_t num_failed = CollectBatch( inputs, batch.output_dir, items );
+
+	auto wall_start = std::chrono::steady_clock::now();
+	FailureReport report;
+	MemoryBudget budget( batch.memory_limit );
+
+	const size_t depth = num_threads * PIPELINE_DEPTH_PER_THREAD;
+	WorkQueue to_lift( depth ), to_fix( depth ), to_structure( depth ), to_write( depth );
+
+	WorkStage lift( "lift", num_threads, to_lift, &to_fix, [&]( std::unique_ptr<FunctionWork>& work ) {
+		TraceSpan span( "function", work->func().name );
+		FunctionStats::Scope use_stats( work->stats );
+		ILNodePool::Scope use_nodes( work->nodes );
+		work->code = std::make_unique<OutputBuffer>();
+		work->ilcfg.reset( LiftFunction( work->smx(), work->func(), options, *work->code ) );
+	} );
+	WorkStage fix( "fix", num_threads, to_fix, &to_structure, [&]( std::unique_ptr<FunctionWork>& work ) {
+		TraceSpan span( "function", work->func().name );
+		FunctionStats::Scope use_stats( work->stats );
+		ILNodePool::Scope use_nodes( work->nodes );
+		FixIL( work->smx(), *work->ilcfg );
+	} );
+	WorkStage structure( "structure", num_threads, to_structure, &to_write, [&]( std::unique_ptr<FunctionWork>& work ) {
+		TraceSpan span( "function", work->func().name );
+		FunctionStats::Scope use_stats( work->stats );
+		ILNodePool::Scope use_nodes( work->nodes );
+		work->structurizer = std::make_unique<Structurizer>( work->ilcfg.get(), options.engine );
+		work->func_stmt = work->structurizer->Transform();
+	} );
+	WorkStage write( "write", num_threads, to_write, nullptr, [&]( std::unique_ptr<FunctionWork>& work ) {
+		{
+			TraceSpan span( "function", work->func().name );
+			FunctionStats::Scope use_stats( work->stats );
+			ILNodePool::Scope use_nodes( work->nodes );
+			WriteFunction( work->smx(), work->func(), work->func_stmt, *work->code );
+		}
+		if( work->stats )
+			CountNodes( work->nodes, *work->stats );
+
+		// Free the IL before the code is passed on, which may close the plugin
+		std::shared_ptr<PipelinePlugin> plugin = work->plugin;
+		size_t index = work->index;
+		std::unique_ptr<OutputBuffer> code = std::move( work->code );
+		work.reset();
+		plugin->output->Finish( index, std::move( code ) );
+	} );
+
+	// Loading happens right here. Pushing blocks while the pipeline is full, which is what keeps
+	// further plugins from being loaded too far ahead.
+	StageStats load;
+	load.name = "load";
+	load.num_threads = 1;
+	for( const BatchItem& item : items )
+	{
+		budget.Acquire( item.memory );
+
+		auto start = std::chrono::steady_clock::now();
+		auto plugin = std::make_shared<PipelinePlugin>();
+		plugin->item = &item;
+		std::string error;
+		if( !OpenPlugin( item, plugin->job, error ) )
+		{
+			report( item, error );
+			budget.Release( item.memory );
+			continue;
+		}
+
+		if( options.globals )
+			WriteGlobals( *plugin->job.smx, *plugin->job.out );
+		plugin->funcs = SelectFunctions( *plugin->job.smx, options );
+		FileStats* file_stats = nullptr;
+		if( batch.stats )
+		{
+			file_stats = plugin->job.stats = &batch.stats->AddFile( item.input.string(), plugin->job.load );
+			file_stats->functions.resize( plugin->funcs.size() );
+		}
+		load.busy_ms += std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+		load.num_items++;
+
+		// The plugin owns its output, so the callback must not hold on to the plugin itself
+		PipelinePlugin* raw_plugin = plugin.get();
+		auto close = [&, raw_plugin] {
+			ClosePlugin( *raw_plugin->item, raw_plugin->job, report );
+			budget.Release( raw_plugin->item->memory );
+		};
+		if( plugin->funcs.empty() )
+		{
+			close();
+			continue;
+		}
+		plugin->output = std::make_unique<OrderedOutput>( *plugin->job.out, plugin->funcs.size(), close );
+
+		for( size_t i = 0; i < plugin->funcs.size(); i++ )
+		{
+			auto work = std::make_unique<FunctionWork>();
+			work->plugin = plugin;
+			work->index = i;
+			if( file_stats )
+			{
+				work->stats = &file_stats->functions[i];
+				work->stats->name = plugin->funcs[i]->name;
+			}
+			to_lift.Push( std::move( work ) );
+		}
+	}
+	to_lift.Close();
+
+	lift.Join();
+	fix.Join();
+	structure.Join();
+	write.Join();
+
+	if( stats )
+	{
+		stats->stages = { load, lift.stats(), fix.stats(), structure.stats(), write.stats() };
+		stats->wall_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - wall_start ).count();
+	}
+
+	return num_failed + report.num_failed();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "decompiler.h"
+#include "pipeline.h"
+
+struct BatchOptions
+{
+	std::filesystem::path output_dir;
+	// Rough ceiling in bytes for the memory of all plugins in flight, 0 for no limit
+	size_t memory_limit = 0;
+	// Collects the timings and counts of every plugin if set
+	DecompileStats* stats = nullptr;
+};
+
+// Decompiles every plugin found in inputs into a mirrored tree under the output directory, one .sp
+// file per plugin. Inputs are .smx files, directories that are searched recursively, or @files
+// listing one input per line. Plugins and their functions all share the scheduler, largest first.
+// Returns the number of plugins that failed.
+size_t RunBatch( const std::vector<std::string>& inputs, const DecompileOptions& options, const BatchOptions& batch,
+	TaskScheduler& scheduler );
+// Decompiles the same plugins into the same files as RunBatch, as a pipeline of stages instead:
+// loading, lifting, typing and fixing, structuring, and writing. Loading runs on the calling thread
+// and every other stage on num_threads threads of its own, 0 for one per hardware thread. The
+// stages are connected by bounded queues, so the next plugin is loaded while the functions of the
+// previous ones are still on their way, and a stage that falls behind holds up the ones before it
+// instead of piling up IL. Fills in stats if given one. Returns the number of plugins that failed.
+size_t RunBatchPipeline( const std::vector<std::string>& inputs, const DecompileOptions& options, const BatchOptions& batch,
+	size_t num_threads, PipelineStats* stats = nullptr );
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "optparse.h"
+#include "smx-file.h"
+#include "cfg-builder.h"
+#include "lifter.h"
+#include "il.h"
+#include "decompiler.h"
+#include "structurizer.h"
+#include "code-writer.h"
+#include "output-buffer.h"
+
+// Times the phases of the decompiler one at a time over the functions of sample plugins. Every
+// phase gets its input prepared up front, so only the phase itself is on the clock. A sample is
+// one pass over every function of a plugin.
+
+struct Summary
+{
+	double min = 0.0;
+	double median = 0.0;
+	double mean = 0.0;
+	double stddev = 0.0;
+	double max = 0.0;
+};
+
+static Summary Summarize( std::vector<double> samples )
+{
+	Summary summary;
+	if( samples.empty() )
+		return summary;
+
+	std::sort( samples.begin(), samples.end() );
+	summary.min = samples.front();
+	summary.max = samples.back();
+
+	size_t mid = samples.size() / 2;
+	summary.median = samples.size() % 2 ? samples[mid] : ( samples[mid - 1] + samples[mid] ) / 2.0;
+
+	double sum = 0.0;
+	for( double sample : samples )
+		sum += sample;
+	summary.mean = sum / samples.size();
+
+	double squares = 0.0;
+	for( double sample : samples )
+		squares += ( sample - summary.mean ) * ( sample - summary.mean );
+	summary.stddev = samples.size() > 1 ? std::sqrt( squares / ( samples.size() - 1 ) ) : 0.0;
+	return summary;
+}
+
+struct BenchOptions
+{
+	size_t warmup = 2;
+	size_t repetitions = 10;
+	// Only run the phase with this name
+	const char* phase = nullptr;
+};
+
+// Runs setup untimed and then run timed, warmup + repetitions times, and keeps the timed samples
+// after the warmup
+static std::vector<double> Measure( const BenchOptions& options, const std::function<void()>& setup,
+	const std::function<void()>& run, const std::function<void()>& teardown )
+{
+	std::vector<double> samples;
+	for( size_t i = 0; i < options.warmup + options.repetitions; i++ )
+	{
+		setup();
+		auto start = std::chrono::steady_clock::now();
+		run();
+		auto end = std::chrono::steady_clock::now();
+		teardown();
+
+		if( i >= options.warmup )
+			samples.push_back( std::chrono::duration<double, std::milli>( end - start ).count() );
+	}
+	return samples;
+}
+
+static void PrintSummary( const std::string& plugin, const char* phase, const Summary& summary )
+{
+	std::cout << std::left << std::setw( 24 ) << plugin << std::setw( 12 ) << phase << std::right << std::fixed
+		<< std::setprecision( 3 )
+		<< std::setw( 11 ) << summary.min
+		<< std::setw( 11 ) << summary.median
+		<< std::setw( 11 ) << summary.mean
+		<< std::setw( 11 ) << summary.stddev
+		<< std::setw( 11 ) << summary.max << "\n";
+}
+
+static void BenchPlugin( const std::string& path, const BenchOptions& options )
+{
+	std::string name = std::filesystem::path( path ).filename().string();
+	auto run_phase = [&]( const char* phase ) { return !options.phase || strcmp( options.phase, phase ) == 0; };
+	auto noop = [] {};
+
+	if( run_phase( "load" ) )
+	{
+		std::unique_ptr<SmxFile> loaded;
+		auto samples = Measure( options, noop,
+			[&] { loaded = std::make_unique<SmxFile>( path.c_str() ); },
+			[&] { loaded.reset(); } );
+		PrintSummary( name, "load", Summarize( samples ) );
+	}
+
+	SmxFile smx( path.c_str() );
+	if( smx.code_size() == 0 )
+	{
+		std::cerr << path << ": not a valid plugin" << std::endl;
+		return;
+	}
+
+	std::vector<SmxFunction*> funcs;
+	for( size_t i = 0; i < smx.num_functions(); i++ )
+		funcs.push_back( &smx.function( i ) );
+
+	if( run_phase( "cfg" ) )
+	{
+		auto samples = Measure( options, noop, [&] {
+			for( SmxFunction* func : funcs )
+			{
+				CfgBuilder builder( smx );
+				builder.Build( smx.code( func->pcode_start ) );
+			}
+		}, noop );
+		PrintSummary( name, "cfg", Summarize( samples ) );
+	}
+
+	// Lifting takes the same control flow graphs every time. Their blocks stay owned by the
+	// builders, so those have to stay around too.
+	std::vector<std::unique_ptr<CfgBuilder>> builders;
+	std::vector<ControlFlowGraph> cfgs;
+	for( SmxFunction* func : funcs )
+	{
+		builders.push_back( std::make_unique<CfgBuilder>( smx ) );
+		cfgs.push_back( builders.back()->Build( smx.code( func->pcode_start ) ) );
+	}
+
+	if( run_phase( "lift" ) )
+	{
+		std::unique_ptr<ILNodePool> nodes;
+		std::vector<std::unique_ptr<ILControlFlowGraph>> ilcfgs;
+		auto samples = Measure( options, [&] { nodes = std::make_unique<ILNodePool>(); }, [&] {
+			ILNodePool::Scope use_nodes( *nodes );
+			for( const ControlFlowGraph& cfg : cfgs )
+			{
+				PcodeLifter lifter( smx );
+				ilcfgs.emplace_back( lifter.Lift( cfg ) );
+			}
+		}, [&] {
+			ilcfgs.clear();
+			nodes.reset();
+		} );
+		PrintSummary( name, "lift", Summarize( samples ) );
+	}
+
+	// The later phases work on fresh IL every time, as structuring changes it. Building it is
+	// part of the setup.
+	std::unique_ptr<ILNodePool> nodes;
+	std::vector<std::unique_ptr<ILControlFlowGraph>> ilcfgs;
+	auto build_il = [&] {
+		nodes = std::make_unique<ILNodePool>();
+		ILNodePool::Scope use_nodes( *nodes );
+		for( SmxFunction* func : funcs )
+			ilcfgs.emplace_back( BuildIL( smx, *func, nullptr ) );
+	};
+	auto free_il = [&] {
+		ilcfgs.clear();
+		nodes.reset();
+	};
+
+	if( run_phase( "dominance" ) )
+	{
+		auto samples = Measure( options, build_il, [&] {
+			for( auto& ilcfg : ilcfgs )
+				ilcfg->ComputeDominance();
+		}, free_il );
+		PrintSummary( name, "dominance", Summarize( samples ) );
+	}
+
+	// The derived sequence is built along with the structurizer, before the clock starts
+	std::vector<std::unique_ptr<Structurizer>> structurizers;
+	std::vector<Statement*> stmts;
+	auto structure_setup = [&] {
+		build_il();
+		ILNodePool::Scope use_nodes( *nodes );
+		for( auto& ilcfg : ilcfgs )
+			structurizers.push_back( std::make_unique<Structurizer>( ilcfg.get(), StructurizerEngine::INTERVALS ) );
+	};
+	auto structure_run = [&] {
+		ILNodePool::Scope use_nodes( *nodes );
+		for( auto& structurizer : structurizers )
+			stmts.push_back( structurizer->Transform() );
+	};
+	auto structure_free = [&] {
+		stmts.clear();
+		structurizers.clear();
+		free_il();
+	};
+
+	if( run_phase( "structure" ) )
+	{
+		auto samples = Measure( options, structure_setup, structure_run, structure_free );
+		PrintSummary( name, "structure", Summarize( samples ) );
+	}
+
+	if( run_phase( "write" ) )
+	{
+		// Writing doesn't change the statements, so they are structured only once
+		structure_setup();
+		structure_run();
+
+		OutputBuffer out;
+		auto samples = Measure( options, [&] { out.clear(); }, [&] {
+			for( size_t i = 0; i < funcs.size(); i++ )
+			{
+				CodeWriter writer( smx, funcs[i]->name );
+				writer.Build( stmts[i], out );
+			}
+		}, noop );
+		PrintSummary( name, "write", Summarize( samples ) );
+
+		structure_free();
+	}
+}
+
+int main( int argc, const char* argv[] )
+{
+	OptParse args;
+	args.AddArgOption( "warmup", 'w' )
+		.AddArgOption( "repetitions", 'r' )
+		.AddArgOption( "phase", 'p' );
+	args.Process( argc, argv );
+
+	if( args.GetArgC() < 1 )
+	{
+		std::cout << "Usage: " << argv[0]
+			<< " [--warmup/-w <count>] [--repetitions/-r <count>]"
+			<< " [--phase/-p <load|cfg|lift|dominance|structure|write>] <plugins>...\n";
+		return 1;
+	}
+
+	BenchOptions options;
+	if( args["warmup"] && *args["warmup"] )
+		options.warmup = (size_t)atoi( args["warmup"] );
+	if( args["repetitions"] && *args["repetitions"] )
+		options.repetitions = std::max( 1, atoi( args["repetitions"] ) );
+	if( args["phase"] && *args["phase"] )
+		options.phase = args["phase"];
+
+	std::cout << options.repetitions << " repetitions after " << options.warmup << " warmup runs, ms per pass over all functions\n";
+	std::cout << std::left << std::setw( 24 ) << "plugin" << std::setw( 12 ) << "phase" << std::right
+		<< std::setw( 11 ) << "min" << std::setw( 11 ) << "median" << std::setw( 11 ) << "mean"
+		<< std::setw( 11 ) << "stddev" << std::setw( 11 ) << "max" << "\n";
+
+	for( size_t i = 0; i < args.GetArgC(); i++ )
+	{
+		std::string path = args.GetArg( (int)i );
+		if( !std::filesystem::exists( path ) )
+		{
+			std::cerr << "Could not open file " << path << std::endl;
+			continue;
+		}
+		BenchPlugin( path, options );
+	}
+	return 0;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// Waits that start out yielding and then sleep for longer and longer, so a thread waiting on an
+// idle queue costs next to nothing while a busy one is picked up again right away
+class Backoff
+{
+public:
+	void Wait()
+	{
+		constexpr int NUM_YIELDS = 64;
+		constexpr int MAX_SLEEP_US = 1000;
+
+		if( num_waits_++ < NUM_YIELDS )
+		{
+			std::this_thread::yield();
+			return;
+		}
+
+		std::this_thread::sleep_for( std::chrono::microseconds( sleep_us_ ) );
+		sleep_us_ = std::min( sleep_us_ * 2, MAX_SLEEP_US );
+	}
+private:
+	int num_waits_ = 0;
+	int sleep_us_ = 50;
+};
+
+// Fixed size queue for any number of producers and consumers that never takes a lock. Every cell
+// has a sequence number that says whose turn it is: a producer may fill the cell when the number
+// equals its position, and a consumer may empty it when the number is one past that. Positions
+// are claimed with a compare-and-swap.
+//
+// Push waits while the queue is full, which holds producers back to the pace of their consumers.
+// That keeps the number of items in flight, and the memory they take, bounded.
+template <typename T>
+class BoundedQueue
+{
+public:
+	// The capacity is rounded up to a power of two
+	explicit BoundedQueue( size_t capacity )
+	{
+		size_t size = 2;
+		while( size < capacity )
+			size *= 2;
+
+		cells_ = std::make_unique<Cell[]>( size );
+		mask_ = size - 1;
+		for( size_t i = 0; i < size; i++ )
+			cells_[i].sequence.store( i, std::memory_order_relaxed );
+	}
+	BoundedQueue( const BoundedQueue& ) = delete;
+	BoundedQueue& operator=( const BoundedQueue& ) = delete;
+
+	// Only moves from value if there was room
+	bool TryPush( T& value )
+	{
+		size_t pos = enqueue_pos_.load( std::memory_order_relaxed );
+		for( ;; )
+		{
+			Cell& cell = cells_[pos & mask_];
+			size_t sequence = cell.sequence.load( std::memory_order_acquire );
+			intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+			if( diff == 0 )
+			{
+				if( enqueue_pos_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				{
+					cell.value = std::move( value );
+					cell.sequence.store( pos + 1, std::memory_order_release );
+					return true;
+				}
+			}
+			else if( diff < 0 )
+			{
+				// The consumers haven't emptied this cell from the last round yet
+				return false;
+			}
+			else
+			{
+				pos = enqueue_pos_.load( std::memory_order_relaxed );
+			}
+		}
+	}
+
+	bool TryPop( T& value )
+	{
+		size_t pos = dequeue_pos_.load( std::memory_order_relaxed );
+		for( ;; )
+		{
+			Cell& cell = cells_[pos & mask_];
+			size_t sequence = cell.sequence.load( std::memory_order_acquire );
+			intptr_t diff = (intptr_t)sequence - (intptr_t)( pos + 1 );
+			if( diff == 0 )
+			{
+				if( dequeue_pos_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				{
+					value = std::move( cell.value );
+					cell.sequence.store( pos + mask_ + 1, std::memory_order_release );
+					return true;
+				}
+			}
+			else if( diff < 0 )
+			{
+				return false;
+			}
+			else
+			{
+				pos = dequeue_pos_.load( std::memory_order_relaxed );
+			}
+		}
+	}
+
+	void Push( T value )
+	{
+		Backoff backoff;
+		while( !TryPush( value ) )
+			backoff.Wait();
+	}
+
+	// Waits for an item. Returns false once the queue is closed and everything in it was taken.
+	bool Pop( T& value )
+	{
+		Backoff backoff;
+		for( ;; )
+		{
+			if( TryPop( value ) )
+				return true;
+
+			// Everything pushed before closing is visible by now, so one more look settles it
+			if( closed_.load( std::memory_order_acquire ) )
+				return TryPop( value );
+
+			backoff.Wait();
+		}
+	}
+
+	// Tells the consumers that nothing more is coming. No pushes may follow.
+	void Close() { closed_.store( true, std::memory_order_release ); }
+
+	size_t capacity() const { return mask_ + 1; }
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells_;
+	size_t mask_;
+
+	// Kept on separate cache lines so producers and consumers don't slow each other down
+	alignas( 64 ) std::atomic<size_t> enqueue_pos_ = 0;
+	alignas( 64 ) std::atomic<size_t> dequeue_pos_ = 0;
+	alignas( 64 ) std::atomic<bool> closed_ = false;
+};
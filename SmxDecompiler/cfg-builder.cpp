@@ -1,6 +1,7 @@
 #include "cfg-builder.h"
 
 #include "smx-disasm.h"
+#include "stats.h"
 #include <algorithm>
 #include <cassert>
 
@@ -9,6 +10,7 @@ CfgBuilder::CfgBuilder( const SmxFile& smx ) : smx_( &smx )
 
 ControlFlowGraph CfgBuilder::Build( const cell_t* entry )
 {
+	PhaseTimer timer( Phase::CFG );
 	MarkLeaders( entry );
 
 	for( const cell_t* leader : leaders_ )
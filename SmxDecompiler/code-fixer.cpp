@@ -1,6 +1,172 @@
 #include "code-fixer.h"
 
 #include "il.h"
+#include <algorithm>
+
+// Base for the fixer passes. A pass only looks at the node it is given, the walk over the IL is
+// done by FixerPipeline. Counts every rewrite that was made, so the pipeline can tell when the
+// fixes have reached a fixpoint
+class FixerVisitor : public ILVisitor
+{
+public:
+	size_t num_changes() const { return num_changes_; }
+	const std::vector<ILNode*>& changed_nodes() const { return changed_nodes_; }
+
+	// The node that took the place of `node` while this pass was visiting it, if any
+	ILNode* TakeReplacement( ILNode* node )
+	{
+		ILNode* replacement = ( replaced_ == node ) ? replacement_ : nullptr;
+		replaced_ = nullptr;
+		replacement_ = nullptr;
+		return replacement;
+	}
+protected:
+	void ReplaceUses( ILNode* node, ILNode* replacement )
+	{
+		if( node->num_uses() )
+		{
+			num_changes_++;
+			changed_nodes_.push_back( replacement );
+			replaced_ = node;
+			replacement_ = replacement;
+		}
+		node->ReplaceUsesWith( replacement );
+	}
+	void ReplaceParam( ILNode* node, ILNode* target, ILNode* replacement )
+	{
+		num_changes_++;
+		changed_nodes_.push_back( node );
+		node->ReplaceParam( target, replacement );
+	}
+private:
+	size_t num_changes_ = 0;
+	std::vector<ILNode*> changed_nodes_;
+	ILNode* replaced_ = nullptr;
+	ILNode* replacement_ = nullptr;
+};
+
+// Runs several fixer passes in a single walk over the IL. Every node is handed to each pass in
+// turn once its operands were visited, the same order a separate post-order walk per pass would
+// see it in. If a pass replaces the node, the passes after it get the replacement instead, walked
+// the same way so they also see the nodes it brought along.
+class FixerPipeline : public RecursiveILVisitor
+{
+public:
+	// `after` lists passes that have to see a node before this one does
+	void Add( FixerVisitor& pass, std::initializer_list<FixerVisitor*> after = {} )
+	{
+		passes_.push_back( &pass );
+		after_.emplace_back( after );
+	}
+
+	size_t num_passes() const { return order_.size(); }
+	FixerVisitor& pass( size_t index ) { return *order_[index]; }
+
+	void Run( ILControlFlowGraph& cfg )
+	{
+		SortPasses();
+
+		for( size_t i = 0; i < cfg.num_blocks(); i++ )
+		{
+			ILBlock& bb = cfg.block( i );
+			for( size_t node = 0; node < bb.num_nodes(); node++ )
+				bb.node( node )->Accept( this );
+		}
+	}
+protected:
+	virtual void VisitConst( ILConst* node ) override { Dispatch( node ); }
+	virtual void VisitUnary( ILUnary* node ) override { RecursiveILVisitor::VisitUnary( node ); Dispatch( node ); }
+	virtual void VisitBinary( ILBinary* node ) override { RecursiveILVisitor::VisitBinary( node ); Dispatch( node ); }
+	virtual void VisitLocalVar( ILLocalVar* node ) override { RecursiveILVisitor::VisitLocalVar( node ); Dispatch( node ); }
+	virtual void VisitGlobalVar( ILGlobalVar* node ) override { Dispatch( node ); }
+	virtual void VisitHeapVar( ILHeapVar* node ) override { Dispatch( node ); }
+	virtual void VisitArrayElementVar( ILArrayElementVar* node ) override { RecursiveILVisitor::VisitArrayElementVar( node ); Dispatch( node ); }
+	virtual void VisitFieldVar( ILFieldVar* node ) override { Dispatch( node ); }
+	virtual void VisitTempVar( ILTempVar* node ) override { Dispatch( node ); }
+	virtual void VisitLoad( ILLoad* node ) override { RecursiveILVisitor::VisitLoad( node ); Dispatch( node ); }
+	virtual void VisitStore( ILStore* node ) override { RecursiveILVisitor::VisitStore( node ); Dispatch( node ); }
+	virtual void VisitJump( ILJump* node ) override { Dispatch( node ); }
+	virtual void VisitJumpCond( ILJumpCond* node ) override { RecursiveILVisitor::VisitJumpCond( node ); Dispatch( node ); }
+	virtual void VisitSwitch( ILSwitch* node ) override { RecursiveILVisitor::VisitSwitch( node ); Dispatch( node ); }
+	virtual void VisitCall( ILCall* node ) override { RecursiveILVisitor::VisitCall( node ); Dispatch( node ); }
+	virtual void VisitNative( ILNative* node ) override { RecursiveILVisitor::VisitNative( node ); Dispatch( node ); }
+	virtual void VisitReturn( ILReturn* node ) override { RecursiveILVisitor::VisitReturn( node ); Dispatch( node ); }
+	virtual void VisitPhi( ILPhi* node ) override { Dispatch( node ); }
+private:
+	void Dispatch( ILNode* node )
+	{
+		for( size_t i = first_pass_; i < order_.size(); i++ )
+		{
+			node->Accept( order_[i] );
+			ILNode* replacement = order_[i]->TakeReplacement( node );
+			if( !replacement )
+				continue;
+
+			// Operands first and then the replacement itself, by the rest of the passes only
+			if( i + 1 < order_.size() )
+			{
+				size_t first_pass = first_pass_;
+				first_pass_ = i + 1;
+				replacement->Accept( this );
+				first_pass_ = first_pass;
+			}
+			return;
+		}
+	}
+
+	// Orders the passes so each one comes after the passes it depends on, otherwise keeping the
+	// order they were added in
+	void SortPasses()
+	{
+		order_.clear();
+		std::vector<bool> placed( passes_.size() );
+		while( order_.size() < passes_.size() )
+		{
+			size_t num_placed = order_.size();
+			for( size_t i = 0; i < passes_.size(); i++ )
+			{
+				if( placed[i] )
+					continue;
+
+				bool ready = true;
+				for( FixerVisitor* dep : after_[i] )
+				{
+					auto it = std::find( passes_.begin(), passes_.end(), dep );
+					if( it != passes_.end() && !placed[it - passes_.begin()] )
+						ready = false;
+				}
+
+				if( ready )
+				{
+					order_.push_back( passes_[i] );
+					placed[i] = true;
+					break;
+				}
+			}
+
+			// Dependencies between the passes can't be circular. If they are anyway, the passes that
+			// are left run in the order they were added instead of the loop never ending
+			if( order_.size() == num_placed )
+			{
+				assert( !"Circular dependency between fixer passes" );
+				for( size_t i = 0; i < passes_.size(); i++ )
+				{
+					if( !placed[i] )
+					{
+						order_.push_back( passes_[i] );
+						placed[i] = true;
+					}
+				}
+			}
+		}
+	}
+private:
+	std::vector<FixerVisitor*> passes_;
+	std::vector<std::vector<FixerVisitor*>> after_;
+	std::vector<FixerVisitor*> order_;
+	// Passes before this one already saw the nodes that are being walked
+	size_t first_pass_ = 0;
+};
 
 // Multidim arrays are accessed a bit oddly
 // The compiler will generate "indirection vectors" for the first dimension
@@ -12,13 +178,11 @@
 // After:
 //  `arr[x][y] = z`
 //
-class FixMultidimArrays : public RecursiveILVisitor
+class FixMultidimArrays : public FixerVisitor
 {
 public:
 	virtual void VisitArrayElementVar( ILArrayElementVar* node ) override
 	{
-		RecursiveILVisitor::VisitArrayElementVar( node );
-
 		ILNode* base;
 		ILNode* index;
 		if( !GetBaseAndIndex( node->base(), &base, &index ) )
@@ -39,7 +203,7 @@ public:
 		if( !AreEquivalentAddresses( iv_val->base(), arr ) )
 			return;
 
-		node->base()->ReplaceUsesWith( iv_val );
+		ReplaceUses( node->base(), iv_val );
 	}
 private:
 	bool GetBaseAndIndex( ILNode* node, ILNode** base, ILNode** index )
@@ -113,17 +277,15 @@ private:
 // After:
 //  `g_var[i] = 0`
 // 
-class FixConstGlobals : public RecursiveILVisitor
+class FixConstGlobals : public FixerVisitor
 {
 public:
 	virtual void VisitArrayElementVar( ILArrayElementVar* node ) override
 	{
-		RecursiveILVisitor::VisitArrayElementVar( node );
-
 		if( auto* constant = dynamic_cast<ILConst*>(node->base()) )
 		{
 			auto* var = new ILGlobalVar( constant->value() );
-			constant->ReplaceUsesWith( var );
+			ReplaceUses( constant, var );
 		}
 	}
 };
@@ -141,13 +303,11 @@ public:
 //  `x = arr[0]`
 //  `PrintToServer("%s", arr[i])`
 //
-class FixArrays : public RecursiveILVisitor
+class FixArrays : public FixerVisitor
 {
 public:
 	virtual void VisitLoad( ILLoad* node ) override
 	{
-		RecursiveILVisitor::VisitLoad( node );
-
 		const SmxVariableType* type = node->var()->type();
 		
 		// Not much we can do without type information at this stage, just bail
@@ -171,12 +331,10 @@ public:
 			new_var = new ILFieldVar( node->var(), 0, enum_struct->FindFieldAtOffset( 0 ) );
 		}
 
-		node->ReplaceParam( node->var(), new_var );
+		ReplaceParam( node, node->var(), new_var );
 	}
 	virtual void VisitStore( ILStore* node ) override
 	{
-		RecursiveILVisitor::VisitStore( node );
-
 		const SmxVariableType* type = node->var()->type();
 
 		// Not much we can do without type information at this stage, just bail
@@ -200,12 +358,10 @@ public:
 			new_var = new ILFieldVar( node->var(), 0, enum_struct->FindFieldAtOffset( 0 ) );
 		}
 
-		node->ReplaceParam( node->var(), new_var );
+		ReplaceParam( node, node->var(), new_var );
 	}
 	virtual void VisitBinary( ILBinary* node ) override
 	{
-		RecursiveILVisitor::VisitBinary( node );
-
 		if( node->op() == ILBinary::ADD )
 		{
 			ILVar* base = nullptr;
@@ -230,7 +386,7 @@ public:
 			if( !index || !base )
 				return;
 
-			node->ReplaceUsesWith( new ILArrayElementVar( base, index ) );
+			ReplaceUses( node, new ILArrayElementVar( base, index ) );
 		}
 	}
 private:
@@ -252,62 +408,53 @@ private:
 // After:
 //  `c = a + b`
 //
-class ReplaceFloatNatives : public RecursiveILVisitor
+class ReplaceFloatNatives : public FixerVisitor
 {
 public:
 	ReplaceFloatNatives( SmxFile& smx ) : smx_( &smx ) {}
 
 	virtual void VisitNative( ILNative* node ) override
 	{
-		// Handle the args of this call, they can contain native calls that we want to replace too
-		RecursiveILVisitor::VisitNative( node );
-
 		SmxNative* native = smx_->FindNativeByIndex( node->native_index() );
 		assert( native );
 
-		if( strcmp( native->name, "FloatMul" ) == 0 || strcmp( native->name, "__FLOAT_MUL__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATMUL, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "FloatDiv" ) == 0 || strcmp( native->name, "__FLOAT_DIV__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATDIV, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "FloatAdd" ) == 0 || strcmp( native->name, "__FLOAT_ADD__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATADD, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "FloatSub" ) == 0 || strcmp( native->name, "__FLOAT_SUB__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATSUB, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "__FLOAT_NOT__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILUnary( node->arg( 0 ), ILUnary::FLOATNOT ) );
-		}
-		else if( strcmp( native->name, "__FLOAT_GT__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATGT, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "__FLOAT_GE__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATGE, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "__FLOAT_LT__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATLT, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "__FLOAT_LE__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATLE, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "__FLOAT_NE__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATNE, node->arg( 1 ) ) );
-		}
-		else if( strcmp( native->name, "__FLOAT_EQ__" ) == 0 )
-		{
-			node->ReplaceUsesWith( new ILBinary( node->arg( 0 ), ILBinary::FLOATEQ, node->arg( 1 ) ) );
+		switch( native->intrinsic )
+		{
+		case SmxNative::NONE:
+			break;
+		case SmxNative::FLOAT_MUL:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATMUL, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_DIV:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATDIV, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_ADD:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATADD, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_SUB:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATSUB, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_NOT:
+			ReplaceUses( node, new ILUnary( node->arg( 0 ), ILUnary::FLOATNOT ) );
+			break;
+		case SmxNative::FLOAT_GT:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATGT, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_GE:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATGE, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_LT:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATLT, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_LE:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATLE, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_NE:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATNE, node->arg( 1 ) ) );
+			break;
+		case SmxNative::FLOAT_EQ:
+			ReplaceUses( node, new ILBinary( node->arg( 0 ), ILBinary::FLOATEQ, node->arg( 1 ) ) );
+			break;
 		}
 	}
 private:
@@ -321,13 +468,13 @@ private:
 // After:
 //  `return`
 //
-class RemoveVoidRets : public ILVisitor
+class RemoveVoidRets : public FixerVisitor
 {
 public:
 	void VisitReturn( ILReturn* node )
 	{
 		if( node->value() )
-			node->ReplaceParam( node->value(), nullptr );
+			ReplaceParam( node, node->value(), nullptr );
 	}
 };
 
@@ -340,13 +487,11 @@ public:
 //  `if (x == 2) {}`
 //  `if (!(x > 0)) {}`
 //
-class UseBoolOps : public RecursiveILVisitor
+class UseBoolOps : public FixerVisitor
 {
 public:
 	void VisitBinary( ILBinary* node )
 	{
-		RecursiveILVisitor::VisitBinary( node );
-
 		if( node->op() != ILBinary::EQ && node->op() != ILBinary::NEQ )
 			return;
 
@@ -360,72 +505,80 @@ public:
 
 			if( node->op() == ILBinary::EQ )
 			{
-				node->ReplaceUsesWith( new ILUnary( node->left(), ILUnary::NOT ) );
+				ReplaceUses( node, new ILUnary( node->left(), ILUnary::NOT ) );
 			}
 			else
 			{
-				node->ReplaceUsesWith( node->left() );
+				ReplaceUses( node, node->left() );
 			}
 		}
 	}
 };
 
-void CodeFixer::ApplyFixes( ILControlFlowGraph& cfg ) const
+void CodeFixer::ApplyFixes( ILControlFlowGraph& cfg )
 {
+	// The node-local fixes all run in one walk
+	FixerPipeline pipeline;
+
 	FixArrays arrays;
-	VisitAllNodes( cfg, arrays );
+	pipeline.Add( arrays );
 	
 	FixMultidimArrays multidim_arrays;
-	VisitAllNodes( cfg, multidim_arrays );
+	pipeline.Add( multidim_arrays, { &arrays } );
 
 	FixConstGlobals fix_const_globals;
-	VisitAllNodes( cfg, fix_const_globals );
+	pipeline.Add( fix_const_globals, { &multidim_arrays } );
 
 	ReplaceFloatNatives replace_float_natives( *smx_ );
-	VisitAllNodes( cfg, replace_float_natives );
+	pipeline.Add( replace_float_natives );
 
+	RemoveVoidRets remove_void_rets;
 	SmxFunction* func = smx_->FindFunctionAt( cfg.Entry().pc() );
 	if( func->signature.ret && func->signature.ret->tag == SmxVariableType::VOID )
-	{
-		RemoveVoidRets remove_void_rets;
-		VisitAllNodes( cfg, remove_void_rets );
-	}
+		pipeline.Add( remove_void_rets );
 
 	UseBoolOps use_bool_ops;
-	VisitAllNodes( cfg, use_bool_ops );
+	pipeline.Add( use_bool_ops, { &replace_float_natives } );
+
+	RunPipeline( cfg, pipeline );
 
 	for( int i = (int)cfg.num_blocks() - 1; i >= 0; i-- )
 	{
-		CleanStores( cfg.block( i ) );
-		CleanIncAndDec( cfg.block( i ) );
-		RemoveTmpLocalVars( cfg.block( i ) );
+		CleanStores( cfg, cfg.block( i ) );
+		CleanIncAndDec( cfg, cfg.block( i ) );
+		RemoveTmpLocalVars( cfg, cfg.block( i ) );
 	}
 
+	// Folding a condition never turns another block into a candidate, so a single sweep is
+	// enough. Folded blocks are removed together at the end instead of one at a time
+	std::vector<ILBlock*> removed;
 	for( int i = (int)cfg.num_blocks() - 1; i >= 0; i-- )
 	{
-		FixShortCircuitConditions( cfg, cfg.block( i ) );
+		FixShortCircuitConditions( cfg, cfg.block( i ), removed );
 	}
-	cfg.ComputeDominance();
+	if( !removed.empty() )
+		cfg.RemoveMultiple( removed.data(), removed.size() );
 
 	for( int i = (int)cfg.num_blocks() - 1; i >= 0; i-- )
 	{
-		FixArrayAndESDecl( cfg.block( i ) );
+		FixArrayAndESDecl( cfg, cfg.block( i ) );
 	}
 }
 
-void CodeFixer::VisitAllNodes( ILControlFlowGraph& cfg, ILVisitor& visitor ) const
+void CodeFixer::RunPipeline( ILControlFlowGraph& cfg, FixerPipeline& pipeline )
 {
-	for( size_t i = 0; i < cfg.num_blocks(); i++ )
+	pipeline.Run( cfg );
+
+	for( size_t i = 0; i < pipeline.num_passes(); i++ )
 	{
-		ILBlock& bb = cfg.block( i );
-		for( size_t node = 0; node < bb.num_nodes(); node++ )
-		{
-			bb.node( node )->Accept( &visitor );
-		}
+		FixerVisitor& pass = pipeline.pass( i );
+		num_changes_ += pass.num_changes();
+		for( ILNode* node : pass.changed_nodes() )
+			cfg.MarkDirty( node );
 	}
 }
 
-void CodeFixer::CleanStores( ILBlock& bb ) const
+void CodeFixer::CleanStores( ILControlFlowGraph& cfg, ILBlock& bb )
 {
 	// There is a common pattern of declaring a local variable then storing a value into it
 	// e.g.
@@ -450,15 +603,19 @@ void CodeFixer::CleanStores( ILBlock& bb ) const
 					if( store_var == decl_var && decl_var->value() == nullptr )
 					{
 						decl_var->SetValue( store->val() );
-						bb.Remove( i );
+						bb.MarkRemoved( i );
+						cfg.MarkDirty( decl_var );
+						num_changes_++;
 					}
 				}
 			}
 		}
 	}
+
+	bb.ApplyEdits();
 }
 
-void CodeFixer::CleanIncAndDec( ILBlock& bb ) const
+void CodeFixer::CleanIncAndDec( ILControlFlowGraph& cfg, ILBlock& bb )
 {
 	// INC/DEC instructions should not be a part of a store since the
 	// store is implicit, however in the pcode the store is explicit
@@ -478,13 +635,15 @@ void CodeFixer::CleanIncAndDec( ILBlock& bb ) const
 				if( unary->op() == ILUnary::INC || unary->op() == ILUnary::DEC )
 				{
 					bb.Replace( i, unary );
+					cfg.MarkDirty( unary );
+					num_changes_++;
 				}
 			}
 		}
 	}
 }
 
-void CodeFixer::RemoveTmpLocalVars( ILBlock& bb ) const
+void CodeFixer::RemoveTmpLocalVars( ILControlFlowGraph& cfg, ILBlock& bb )
 {
 	// Sometimes local vars are used to store result from other var.
 	// This pass will optimize out those local vars and use the result immediately.
@@ -509,8 +668,10 @@ void CodeFixer::RemoveTmpLocalVars( ILBlock& bb ) const
 			if( !local_var->value() || local_var->num_uses() > 1 )
 				continue;
 
+			cfg.MarkDirty( local_var->value() );
 			local_var->ReplaceUsesWith( local_var->value() );
-			bb.Remove( i );
+			bb.MarkRemoved( i );
+			num_changes_++;
 		}
 		else if( auto* tmp_var = dynamic_cast<ILTempVar*>(bb.node( i )) )
 		{
@@ -520,13 +681,17 @@ void CodeFixer::RemoveTmpLocalVars( ILBlock& bb ) const
 			if( !tmp_var->value() || tmp_var->num_uses() > 1 )
 				continue;
 
+			cfg.MarkDirty( tmp_var->value() );
 			tmp_var->ReplaceUsesWith( tmp_var->value() );
-			bb.Remove( i );
+			bb.MarkRemoved( i );
+			num_changes_++;
 		}
 	}
+
+	bb.ApplyEdits();
 }
 
-void CodeFixer::FixArrayAndESDecl( ILBlock& bb ) const
+void CodeFixer::FixArrayAndESDecl( ILControlFlowGraph& cfg, ILBlock& bb )
 {
 	// Often times the lifter will give us a local var with an attached value instead of a store.
 	// Most of the time this is good since it combines the declaration/initialization, but for
@@ -574,12 +739,18 @@ void CodeFixer::FixArrayAndESDecl( ILBlock& bb ) const
 
 			ILNode* value = local_var->value();
 			local_var->ReplaceParam( value, nullptr );
-			bb.Insert( i + 1, new ILStore( new_var, value ) );
+			auto* store = new ILStore( new_var, value );
+			bb.QueueInsert( i + 1, store );
+			cfg.MarkDirty( local_var );
+			cfg.MarkDirty( store );
+			num_changes_++;
 		}
 	}
+
+	bb.ApplyEdits();
 }
 
-void CodeFixer::FixShortCircuitConditions( ILControlFlowGraph& cfg, ILBlock& bb ) const
+void CodeFixer::FixShortCircuitConditions( ILControlFlowGraph& cfg, ILBlock& bb, std::vector<ILBlock*>& removed )
 {
 	// Short circuit conditions (&&/||) generate code that assigns to some tmp var, then
 	// checks the tmp var to actually run the user code. This pass removes the tmp var
@@ -659,16 +830,25 @@ void CodeFixer::FixShortCircuitConditions( ILControlFlowGraph& cfg, ILBlock& bb
 		real_cond_block->AddInEdge( bb.in_edge( i ) );
 	}
 
-	for( int i = (int)bb.num_nodes() - 2; i >= 0; i-- )
+	// The declaration of tmp was moved to the end of bb with the phi, bb being the immediate
+	// dominator of the real block, so it's dropped instead of moved along
+	for( size_t i = 0; i + 1 < bb.num_nodes(); i++ )
 	{
-		real_cond_block->AddToStart( bb.node( i ) );
+		if( bb.node( i ) != tmp )
+			real_cond_block->QueueInsert( 0, bb.node( i ) );
 	}
+	real_cond_block->ApplyEdits();
+
+	cfg.MergeDominance( *real_cond_block, *then_branch );
+	cfg.MergeDominance( *real_cond_block, *else_branch );
+	cfg.MergeDominance( *real_cond_block, bb );
 
-	ILBlock* remove[] = { &bb, then_branch, else_branch };
-	cfg.RemoveMultiple( remove, 3 );
+	removed.push_back( &bb );
+	removed.push_back( then_branch );
+	removed.push_back( else_branch );
+	num_changes_++;
 
 	// Remove unnecessary references to tmp
-	real_cond_block->Remove( tmp );
 	for( int i = (int)tmp->num_uses() - 1; i >= 0; i-- )
 	{
 		if( auto* store = dynamic_cast<ILStore*>( tmp->use( i ) ) )
@@ -684,4 +864,5 @@ void CodeFixer::FixShortCircuitConditions( ILControlFlowGraph& cfg, ILBlock& bb
 	}
 
 	tmp->ReplaceUsesWith( node->condition() );
+	cfg.MarkDirty( node->condition() );
 }
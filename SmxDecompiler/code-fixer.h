@@ -8,15 +8,19 @@ class CodeFixer
 public:
 	CodeFixer( SmxFile& smx ) : smx_( &smx ) {}
 
-	void ApplyFixes( ILControlFlowGraph& cfg ) const;
+	void ApplyFixes( ILControlFlowGraph& cfg );
+
+	// Total number of changes made to the IL by this fixer, used to detect a fixpoint
+	size_t num_changes() const { return num_changes_; }
 private:
-	void CleanStores( ILBlock& bb ) const;
-	void CleanIncAndDec( ILBlock& bb ) const;
-	void RemoveTmpLocalVars( ILBlock& bb ) const;
-	void FixArrayAndESDecl( ILBlock& bb ) const;
-	void FixShortCircuitConditions( ILControlFlowGraph& cfg, ILBlock& bb ) const;
+	void CleanStores( ILControlFlowGraph& cfg, ILBlock& bb );
+	void CleanIncAndDec( ILControlFlowGraph& cfg, ILBlock& bb );
+	void RemoveTmpLocalVars( ILControlFlowGraph& cfg, ILBlock& bb );
+	void FixArrayAndESDecl( ILControlFlowGraph& cfg, ILBlock& bb );
+	void FixShortCircuitConditions( ILControlFlowGraph& cfg, ILBlock& bb, std::vector<ILBlock*>& removed );
 
-	void VisitAllNodes( ILControlFlowGraph& cfg, class ILVisitor& visitor ) const;
+	void RunPipeline( ILControlFlowGraph& cfg, class FixerPipeline& pipeline );
 private:
 	SmxFile* smx_;
+	size_t num_changes_ = 0;
 };
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "code-writer.h"
 
+#include "stats.h"
+
 CodeWriter::CodeWriter( SmxFile& smx, const char* function ) :
 	smx_( &smx )
 {
@@ -8,39 +10,52 @@ CodeWriter::CodeWriter( SmxFile& smx, const char* function ) :
 
 std::string CodeWriter::Build( Statement* stmt )
 {
+	OutputBuffer out;
+	Build( stmt, out );
+	return out.str();
+}
+
+void CodeWriter::Build( Statement* stmt, OutputBuffer& out )
+{
+	PhaseTimer timer( Phase::WRITE );
+	code_ = &out;
+
 	if( func_->is_public )
-		code_ << "public ";
-	code_ << BuildFuncDecl( func_->name, &func_->signature ) << '\n';
-	code_ << "{\n";
+		code() << "public ";
+	WriteFuncDecl( code(), func_->name, &func_->signature );
+	code() << '\n';
+	code() << "{\n";
 	Indent();
 	Visit( stmt );
 	Dedent();
-	code_ << "}\n";
-	return code_.str();
+	code() << "}\n";
+
+	code_ = nullptr;
 }
 
 void CodeWriter::VisitBasicStatement( BasicStatement * stmt )
 {
 	for( size_t node = 0; node < stmt->num_nodes(); node++ )
 	{
-		code_ << Tabs() << Build( stmt->node( node ) ) << ";\n";
+		code() << Tabs();
+		Write( stmt->node( node ) );
+		code() << ";\n";
 	}
 }
 
 void CodeWriter::VisitIfStatement( IfStatement* stmt )
 {
 	bool old = in_else_if_;
-	if( in_else_if_ )
-		code_ << Tabs() << "else if (" << Build( stmt->condition() ) << ")\n";
-	else
-		code_ << Tabs() << "if (" << Build( stmt->condition() ) << ")\n";
-	code_ << Tabs() << "{\n";
+	code() << Tabs() << ( in_else_if_ ? "else if (" : "if (" );
+	Write( stmt->condition() );
+	code() << ")\n";
+	code() << Tabs() << "{\n";
 	Indent();
 	in_else_if_ = false;
 	if( stmt->then_branch() )
 		Visit( stmt->then_branch() );
 	Dedent();
-	code_ << Tabs() << "}\n";
+	code() << Tabs() << "}\n";
 	if( stmt->else_branch() )
 	{
 		auto* else_if = dynamic_cast<IfStatement*>(stmt->else_branch());
@@ -53,12 +68,12 @@ void CodeWriter::VisitIfStatement( IfStatement* stmt )
 		else
 		{
 			in_else_if_ = false;
-			code_ << Tabs() << "else\n";
-			code_ << Tabs() << "{\n";
+			code() << Tabs() << "else\n";
+			code() << Tabs() << "{\n";
 			Indent();
 			Visit( stmt->else_branch() );
 			Dedent();
-			code_ << Tabs() << "}\n";
+			code() << Tabs() << "}\n";
 		}
 	}
 	in_else_if_ = old;
@@ -66,100 +81,106 @@ void CodeWriter::VisitIfStatement( IfStatement* stmt )
 
 void CodeWriter::VisitDoWhileStatement( DoWhileStatement* stmt )
 {
-	code_ << Tabs() << "do\n";
-	code_ << Tabs() << "{\n";
+	code() << Tabs() << "do\n";
+	code() << Tabs() << "{\n";
 	if( stmt->body() )
 	{
 		Indent();
 		Visit( stmt->body() );
 		Dedent();
 	}
-	code_ << Tabs() << "} while (" << Build( stmt->condition() ) << ");\n";
+	code() << Tabs() << "} while (";
+	Write( stmt->condition() );
+	code() << ");\n";
 }
 
 void CodeWriter::VisitEndlessStatement( EndlessStatement* stmt )
 {
-	code_ << Tabs() << "while (true)";
+	code() << Tabs() << "while (true)";
 	if( stmt->body() )
 	{
-		code_ << '\n';
-		code_ << Tabs() << "{\n";
+		code() << '\n';
+		code() << Tabs() << "{\n";
 		Indent();
 		Visit( stmt->body() );
 		Dedent();
-		code_ << Tabs() << "}\n";
+		code() << Tabs() << "}\n";
 	}
 	else
 	{
-		code_ << ";\n";
+		code() << ";\n";
 	}
 }
 
 void CodeWriter::VisitWhileStatement( WhileStatement* stmt )
 {
-	code_ << Tabs() << "while (" << Build( stmt->condition() ) << ")";
+	code() << Tabs() << "while (";
+	Write( stmt->condition() );
+	code() << ")";
 	if( stmt->body() )
 	{
-		code_ << '\n';
-		code_ << Tabs() << "{\n";
+		code() << '\n';
+		code() << Tabs() << "{\n";
 		Indent();
 		Visit( stmt->body() );
 		Dedent();
-		code_ << Tabs() << "}\n";
+		code() << Tabs() << "}\n";
 	}
 	else
 	{
-		code_ << ";\n";
+		code() << ";\n";
 	}
 }
 
 void CodeWriter::VisitSwitchStatement( SwitchStatement* stmt )
 {
-	code_ << Tabs() << "switch (" << Build( stmt->value() ) << ")\n";
-	code_ << Tabs() << "{\n";
+	code() << Tabs() << "switch (";
+	Write( stmt->value() );
+	code() << ")\n";
+	code() << Tabs() << "{\n";
 	Indent();
 	for( size_t i = 0; i < stmt->num_cases(); i++ )
 	{
-		code_ << Tabs() << "case " << stmt->case_entry( i ).value << ":\n";
-		code_ << Tabs() << "{\n";
+		code() << Tabs() << "case " << stmt->case_entry( i ).value << ":\n";
+		code() << Tabs() << "{\n";
 		Indent();
 		Visit( stmt->case_entry( i ).body );
 		Dedent();
-		code_ << Tabs() << "}\n";
+		code() << Tabs() << "}\n";
 	}
 
 	if( stmt->default_case() )
 	{
-		code_ << Tabs() << "default:\n";
-		code_ << Tabs() << "{\n";
+		code() << Tabs() << "default:\n";
+		code() << Tabs() << "{\n";
 		Indent();
 		Visit( stmt->default_case() );
 		Dedent();
-		code_ << Tabs() << "}\n";
+		code() << Tabs() << "}\n";
 	}
 	Dedent();
-	code_ << Tabs() << "}\n";
+	code() << Tabs() << "}\n";
 }
 
 void CodeWriter::VisitContinueStatement( ContinueStatement* stmt )
 {
-	code_ << Tabs() << "continue;\n";
+	code() << Tabs() << "continue;\n";
 }
 
 void CodeWriter::VisitBreakStatement( BreakStatement* stmt )
 {
-	code_ << Tabs() << "break;\n";
+	code() << Tabs() << "break;\n";
 }
 
 void CodeWriter::VisitGotoStatement( GotoStatement* stmt )
 {
-	code_ << Tabs() << "goto " << stmt->target()->label() << ";\n";
+	code() << Tabs() << "goto " << stmt->target()->label() << ";\n";
 }
 
 void CodeWriter::VisitConst( ILConst* node )
 {
 	cell_t value = node->value();
-	code_ << BuildTypedValue( &value, node->type() );
+	WriteTypedValue( code(), &value, node->type() );
 }
 
 void CodeWriter::VisitUnary( ILUnary* node )
@@ -168,13 +189,16 @@ void CodeWriter::VisitUnary( ILUnary* node )
 	{
 	case ILUnary::FLOATNOT:
 	case ILUnary::NOT:
-		code_ << "!" << Build( node->val() );
+		code() << "!";
+		Write( node->val() );
 		break;
 	case ILUnary::NEG:
-		code_ << "-" << Build( node->val() );
+		code() << "-";
+		Write( node->val() );
 		break;
 	case ILUnary::INVERT:
-		code_ << "~" << Build( node->val() );
+		code() << "~";
+		Write( node->val() );
 		break;
 
 	case ILUnary::FABS:
@@ -183,14 +207,16 @@ void CodeWriter::VisitUnary( ILUnary* node )
 	case ILUnary::RND_TO_CEIL:
 	case ILUnary::RND_TO_ZERO:
 	case ILUnary::RND_TO_FLOOR:
-		code_ << "<err>";
+		code() << "<err>";
 		break;
 
 	case ILUnary::INC:
-		code_ << "++" << Build( node->val() );
+		code() << "++";
+		Write( node->val() );
 		break;
 	case ILUnary::DEC:
-		code_ << "--" << Build( node->val() );
+		code() << "--";
+		Write( node->val() );
 		break;
 	}
 }
@@ -199,39 +225,39 @@ void CodeWriter::VisitBinary( ILBinary* node )
 {
 	switch( node->op() )
 	{
-		case ILBinary::ADD:      code_ << Build( node->left() ) << " + " << Build( node->right() ); break;
-		case ILBinary::SUB:      code_ << Build( node->left() ) << " - " << Build( node->right() ); break;
-		case ILBinary::DIV:      code_ << Build( node->left() ) << " / " << Build( node->right() ); break;
-		case ILBinary::MUL:      code_ << Build( node->left() ) << " * " << Build( node->right() ); break;
-		case ILBinary::MOD:      code_ << Build( node->left() ) << " % " << Build( node->right() ); break;
-		case ILBinary::SHL:      code_ << Build( node->left() ) << " << " << Build( node->right() ); break;
-		case ILBinary::SHR:      code_ << Build( node->left() ) << " >> " << Build( node->right() ); break;
-		case ILBinary::SSHR:     code_ << Build( node->left() ) << " >> " << Build( node->right() ); break;
-		case ILBinary::BITAND:      code_ << Build( node->left() ) << " & " << Build( node->right() ); break;
-		case ILBinary::BITOR:       code_ << Build( node->left() ) << " | " << Build( node->right() ); break;
-		case ILBinary::XOR:      code_ << Build( node->left() ) << " ^ " << Build( node->right() ); break;
-
-		case ILBinary::EQ:       code_ << Build( node->left() ) << " == " << Build( node->right() ); break;
-		case ILBinary::NEQ:      code_ << Build( node->left() ) << " != " << Build( node->right() ); break;
-		case ILBinary::SGRTR:    code_ << Build( node->left() ) << " > " << Build( node->right() ); break;
-		case ILBinary::SGEQ:     code_ << Build( node->left() ) << " >= " << Build( node->right() ); break;
-		case ILBinary::SLESS:    code_ << Build( node->left() ) << " < " << Build( node->right() ); break;
-		case ILBinary::SLEQ:     code_ << Build( node->left() ) << " <= " << Build( node->right() ); break;
-		case ILBinary::AND:      code_ << Build( node->left() ) << " && " << Build( node->right() ); break;
-		case ILBinary::OR:       code_ << Build( node->left() ) << " || " << Build( node->right() ); break;
-
-		case ILBinary::FLOATADD: code_ << Build( node->left() ) << " + " << Build( node->right() ); break;
-		case ILBinary::FLOATSUB: code_ << Build( node->left() ) << " - " << Build( node->right() ); break;
-		case ILBinary::FLOATMUL: code_ << Build( node->left() ) << " * " << Build( node->right() ); break;
-		case ILBinary::FLOATDIV: code_ << Build( node->left() ) << " / " << Build( node->right() ); break;
-
-		case ILBinary::FLOATCMP: code_ << Build( node->left() ) << " fcmp " << Build( node->right() ); break;
-		case ILBinary::FLOATGT:  code_ << Build( node->left() ) << " > " << Build( node->right() ); break;
-		case ILBinary::FLOATGE:  code_ << Build( node->left() ) << " >= " << Build( node->right() ); break;
-		case ILBinary::FLOATLE:  code_ << Build( node->left() ) << " <= " << Build( node->right() ); break;
-		case ILBinary::FLOATLT:  code_ << Build( node->left() ) << " < " << Build( node->right() ); break;
-		case ILBinary::FLOATEQ:  code_ << Build( node->left() ) << " == " << Build( node->right() ); break;
-		case ILBinary::FLOATNE:  code_ << Build( node->left() ) << " != " << Build( node->right() ); break;
+		case ILBinary::ADD:      WriteBinary( node, " + " ); break;
+		case ILBinary::SUB:      WriteBinary( node, " - " ); break;
+		case ILBinary::DIV:      WriteBinary( node, " / " ); break;
+		case ILBinary::MUL:      WriteBinary( node, " * " ); break;
+		case ILBinary::MOD:      WriteBinary( node, " % " ); break;
+		case ILBinary::SHL:      WriteBinary( node, " << " ); break;
+		case ILBinary::SHR:      WriteBinary( node, " >> " ); break;
+		case ILBinary::SSHR:     WriteBinary( node, " >> " ); break;
+		case ILBinary::BITAND:      WriteBinary( node, " & " ); break;
+		case ILBinary::BITOR:       WriteBinary( node, " | " ); break;
+		case ILBinary::XOR:      WriteBinary( node, " ^ " ); break;
+
+		case ILBinary::EQ:       WriteBinary( node, " == " ); break;
+		case ILBinary::NEQ:      WriteBinary( node, " != " ); break;
+		case ILBinary::SGRTR:    WriteBinary( node, " > " ); break;
+		case ILBinary::SGEQ:     WriteBinary( node, " >= " ); break;
+		case ILBinary::SLESS:    WriteBinary( node, " < " ); break;
+		case ILBinary::SLEQ:     WriteBinary( node, " <= " ); break;
+		case ILBinary::AND:      WriteBinary( node, " && " ); break;
+		case ILBinary::OR:       WriteBinary( node, " || " ); break;
+
+		case ILBinary::FLOATADD: WriteBinary( node, " + " ); break;
+		case ILBinary::FLOATSUB: WriteBinary( node, " - " ); break;
+		case ILBinary::FLOATMUL: WriteBinary( node, " * " ); break;
+		case ILBinary::FLOATDIV: WriteBinary( node, " / " ); break;
+
+		case ILBinary::FLOATCMP: WriteBinary( node, " fcmp " ); break;
+		case ILBinary::FLOATGT:  WriteBinary( node, " > " ); break;
+		case ILBinary::FLOATGE:  WriteBinary( node, " >= " ); break;
+		case ILBinary::FLOATLE:  WriteBinary( node, " <= " ); break;
+		case ILBinary::FLOATLT:  WriteBinary( node, " < " ); break;
+		case ILBinary::FLOATEQ:  WriteBinary( node, " == " ); break;
+		case ILBinary::FLOATNE:  WriteBinary( node, " != " ); break;
 	}
 }
 
@@ -257,16 +283,19 @@ void CodeWriter::VisitLocalVar( ILLocalVar* node )
 	if( level_ == 1 )
 	{
 		// This is a top level node, so it's a variable declaration
-		code_ << BuildVarDecl( var_name, node->type() );
+		WriteVarDecl( code(), var_name, node->type() );
 
 		if( node->value() )
-			code_ << " = " << Build( node->value() );
+		{
+			code() << " = ";
+			Write( node->value() );
+		}
 	}
 	else
 	{
 		// Variable is being referenced somewhere after already being declared
 		// Just output the name
-		code_ << var_name;
+		code() << var_name;
 	}
 }
 
@@ -274,19 +303,19 @@ void CodeWriter::VisitGlobalVar( ILGlobalVar* node )
 {
 	if( node->smx_var() )
 	{
-		code_ << node->smx_var()->name;
+		code() << node->smx_var()->name;
 	}
 	else
 	{
-		code_ << "global_" << node->addr();
+		code() << "global_" << node->addr();
 	}
 }
 
 void CodeWriter::VisitHeapVar( ILHeapVar* node )
 {
-	code_ << "heap_" << node->addr();
+	code() << "heap_" << node->addr();
 	if( level_ == 1 )
-		code_ << " = alloc(" << node->size() << ")";
+		code() << " = alloc(" << node->size() << ")";
 }
 
 void CodeWriter::VisitArrayElementVar( ILArrayElementVar* node )
@@ -303,17 +332,22 @@ void CodeWriter::VisitArrayElementVar( ILArrayElementVar* node )
 				size = 1;
 		}
 
-		code_ << Build( node->base() ) << '[' << std::to_string( constant->value() / size ) << ']';
+		Write( node->base() );
+		code() << '[' << constant->value() / size << ']';
 	}
 	else
 	{
-		code_ << Build( node->base() ) << '[' << Build( node->index() ) << ']';
+		Write( node->base() );
+		code() << '[';
+		Write( node->index() );
+		code() << ']';
 	}
 }
 
 void CodeWriter::VisitFieldVar( ILFieldVar* node )
 {
-	code_ << Build( node->base() ) << '.' << node->field()->name;
+	Write( node->base() );
+	code() << '.' << node->field()->name;
 }
 
 void CodeWriter::VisitTempVar( ILTempVar* node )
@@ -321,24 +355,29 @@ void CodeWriter::VisitTempVar( ILTempVar* node )
 	std::string var_name = "tmp_" + std::to_string( node->index() );
 	if( level_ == 1 )
 	{
-		code_ << BuildVarDecl( var_name, node->type() );
+		WriteVarDecl( code(), var_name, node->type() );
 		if( node->value() )
-			code_ << " = " << Build( node->value() );
+		{
+			code() << " = ";
+			Write( node->value() );
+		}
 	}
 	else
 	{
-		code_ << var_name;
+		code() << var_name;
 	}
 }
 
 void CodeWriter::VisitLoad( ILLoad* node )
 {
-	code_ << Build( node->var() );
+	Write( node->var() );
 }
 
 void CodeWriter::VisitStore( ILStore* node )
 {
-	code_ << Build( node->var() ) << " = " << Build( node->val() );
+	Write( node->var() );
+	code() << " = ";
+	Write( node->val() );
 }
 
 void CodeWriter::VisitJump( ILJump* node )
@@ -353,23 +392,23 @@ void CodeWriter::VisitCall( ILCall* node )
 {
 	if( SmxFunction* func = smx_->FindFunctionAt( node->addr() ) )
 	{
-		code_ << func->name;
+		code() << func->name;
 	}
 	else
 	{
-		code_ << "func_" << node->addr();
+		code() << "func_" << node->addr();
 	}
 
-	code_ << "(";
+	code() << "(";
 	for( size_t i = 0; i < node->num_args(); i++ )
 	{
-		code_ << Build( node->arg( i ) );
+		Write( node->arg( i ) );
 		if( i != node->num_args() - 1 )
 		{
-			code_ << ", ";
+			code() << ", ";
 		}
 	}
-	code_ << ")";
+	code() << ")";
 }
 
 void CodeWriter::VisitNative( ILNative* node )
@@ -377,30 +416,33 @@ void CodeWriter::VisitNative( ILNative* node )
 	SmxNative* native = smx_->FindNativeByIndex( node->native_index() );
 	if( native )
 	{
-		code_ << native->name;
+		code() << native->name;
 	}
 	else
 	{
-		code_ << "native_" << node->native_index();
+		code() << "native_" << node->native_index();
 	}
 
-	code_ << "(";
+	code() << "(";
 	for( size_t i = 0; i < node->num_args(); i++ )
 	{
-		code_ << Build( node->arg( i ) );
+		Write( node->arg( i ) );
 		if( i != node->num_args() - 1 )
 		{
-			code_ << ", ";
+			code() << ", ";
 		}
 	}
-	code_ << ")";
+	code() << ")";
 }
 
 void CodeWriter::VisitReturn( ILReturn* node )
 {
-	code_ << "return";
+	code() << "return";
 	if( node->value() )
-		code_ << " " << Build(node->value());
+	{
+		code() << " ";
+		Write( node->value() );
+	}
 }
 
 void CodeWriter::VisitPhi( ILPhi* node )
@@ -408,11 +450,6 @@ void CodeWriter::VisitPhi( ILPhi* node )
 	assert( false );
 }
 
-void CodeWriter::VisitInterval( ILInterval* node )
-{
-	assert( false );
-}
-
 void CodeWriter::Visit( Statement* stmt )
 {
 	do
@@ -420,7 +457,7 @@ void CodeWriter::Visit( Statement* stmt )
 		if( stmt->label() )
 		{
 			Dedent();
-			code_ << Tabs() << stmt->label() << ":\n";
+			code() << Tabs() << stmt->label() << ":\n";
 			Indent();
 		}
 
@@ -429,23 +466,34 @@ void CodeWriter::Visit( Statement* stmt )
 	} while( stmt != nullptr );
 }
 
-std::string CodeWriter::Build( ILNode* node )
+void CodeWriter::Write( ILNode* node )
 {
 	level_++;
 	node->Accept( this );
 	level_--;
-	return "";
 }
 
-std::string CodeWriter::BuildVarDecl( const std::string& var_name, const SmxVariableType* type )
+void CodeWriter::WriteBinary( ILBinary* node, const char* op )
 {
-	std::ostringstream decl_str;
+	Write( node->left() );
+	code() << op;
+	Write( node->right() );
+}
+
+std::string CodeWriter::BuildVarDecl( std::string_view var_name, const SmxVariableType* type )
+{
+	OutputBuffer out;
+	WriteVarDecl( out, var_name, type );
+	return out.str();
+}
 
+void CodeWriter::WriteVarDecl( OutputBuffer& decl_str, std::string_view var_name, const SmxVariableType* type )
+{
 	if( !type )
 	{
 		// No type info, just assume int
 		decl_str << "int " << var_name;
-		return decl_str.str();
+		return;
 	}
 
 	if( type->flags & SmxVariableType::IS_CONST )
@@ -512,18 +560,14 @@ std::string CodeWriter::BuildVarDecl( const std::string& var_name, const SmxVari
 			decl_str << type->dims[i];
 		decl_str << "]";
 	}
-
-	return decl_str.str();
 }
 
-std::string CodeWriter::BuildFuncDecl( const std::string& func_name, const SmxFunctionSignature* sig )
+void CodeWriter::WriteFuncDecl( OutputBuffer& decl_str, std::string_view func_name, const SmxFunctionSignature* sig )
 {
-	std::ostringstream decl_str;
-
 	if( !sig )
 	{
 		decl_str << "int " << func_name << "()";
-		return decl_str.str();
+		return;
 	}
 
 	if( !sig->ret )
@@ -532,7 +576,7 @@ std::string CodeWriter::BuildFuncDecl( const std::string& func_name, const SmxFu
 	}
 	else
 	{
-		decl_str << BuildVarDecl( "", sig->ret );
+		WriteVarDecl( decl_str, "", sig->ret );
 	}
 
 	decl_str << func_name << '(';
@@ -542,22 +586,23 @@ std::string CodeWriter::BuildFuncDecl( const std::string& func_name, const SmxFu
 			decl_str << ", ";
 		if( sig->args[i].name )
 		{
-			decl_str << BuildVarDecl( sig->args[i].name, &sig->args[i].type );
+			WriteVarDecl( decl_str, sig->args[i].name, &sig->args[i].type );
 		}
 		else
 		{
-			decl_str << BuildVarDecl( "arg" + std::to_string( i + 1 ), &sig->args[i].type );
+			WriteVarDecl( decl_str, "arg" + std::to_string( i + 1 ), &sig->args[i].type );
 		}
 	}
 	decl_str << ')';
-
-	return decl_str.str();
 }
 
-std::string CodeWriter::BuildTypedValue( cell_t* val, const SmxVariableType* type )
+void CodeWriter::WriteTypedValue( OutputBuffer& out, cell_t* val, const SmxVariableType* type )
 {
 	if( !type )
-		return std::to_string( *val );
+	{
+		out << *val;
+		return;
+	}
 
 	switch( type->tag )
 	{
@@ -566,11 +611,13 @@ std::string CodeWriter::BuildTypedValue( cell_t* val, const SmxVariableType* typ
 		case SmxVariableType::INT:
 		case SmxVariableType::ANY:
 			//assert( type->dimcount == 0 );
-			return std::to_string( *val );
+			out << *val;
+			break;
 
 		case SmxVariableType::BOOL:
 			assert( type->dimcount == 0 );
-			return (*val) ? "true" : "false";
+			out << ( (*val) ? "true" : "false" );
+			break;
 
 		case SmxVariableType::FLOAT:
 		{
@@ -586,24 +633,30 @@ std::string CodeWriter::BuildTypedValue( cell_t* val, const SmxVariableType* typ
 
 			char buf[32];
 			snprintf( buf, sizeof( buf ), "%g", x.f );
-			return buf;
+			out << buf;
+			break;
 		}
 
 		case SmxVariableType::CHAR:
 		{
 			if( type->dimcount == 0 )
 			{
-				return std::string("'") + BuildEscapedChar(*val, '\'') + "'";
+				out << '\'';
+				WriteEscapedChar( out, *val, '\'' );
+				out << '\'';
+				break;
 			}
 
-			return BuildStringLiteral( (char*)smx_->data(*val) );
+			WriteStringLiteral( out, (char*)smx_->data(*val) );
+			break;
 		}
 
 		case SmxVariableType::ENUM:
 		{
 			// TODO: Figure out what the value corresponds to in the enum?
 			assert( type->dimcount == 0 );
-			return std::to_string( *val );
+			out << *val;
+			break;
 		}
 
 		case SmxVariableType::TYPEDEF:
@@ -611,30 +664,40 @@ std::string CodeWriter::BuildTypedValue( cell_t* val, const SmxVariableType* typ
 		{
 			assert( type->dimcount == 0 );
 			if( *val == 0 )
-				return "INVALID_FUNCTION";
+			{
+				out << "INVALID_FUNCTION";
+				break;
+			}
 			SmxFunction* func = smx_->FindFunctionById( *val );
 			if( !func )
-				return "<error>";
-			return func->name;
+			{
+				out << "<error>";
+				break;
+			}
+			out << func->name;
+			break;
 		}
 
 		case SmxVariableType::ENUM_STRUCT:
 		{
-			return std::to_string( *val ) + " /* Unhandled field access */";
+			out << *val << " /* Unhandled field access */";
+			break;
 		}
 
 		default:
 			assert( 0 );
-			return std::to_string( *val );
+			out << *val;
+			break;
 	}
 }
 
-std::string CodeWriter::Tabs()
+std::string_view CodeWriter::Tabs()
 {
-	std::string tabs;
-	for( int i = 0; i < indent_; i++ )
-		tabs += "  ";
-	return tabs;
+	// All indentation levels are prefixes of the same string
+	size_t size = indent_ * 2;
+	if( tabs_.size() < size )
+		tabs_.resize( size * 2, ' ' );
+	return std::string_view( tabs_.data(), size );
 }
 
 void CodeWriter::Indent()
@@ -647,54 +710,47 @@ void CodeWriter::Dedent()
 	indent_--;
 }
 
-std::string CodeWriter::BuildStringLiteral( const char* str )
+void CodeWriter::WriteStringLiteral( OutputBuffer& out, const char* str )
 {
-	std::string lit;
-	lit += '"';
+	out << '"';
 	for( const char* c = str; *c; c++ )
 	{
-		lit += BuildEscapedChar( *c, '"' );
+		WriteEscapedChar( out, *c, '"' );
 	}
-	lit += '"';
-
-	return lit;
+	out << '"';
 }
 
-std::string CodeWriter::BuildEscapedChar( char c, char quote )
+void CodeWriter::WriteEscapedChar( OutputBuffer& out, char c, char quote )
 {
-	std::string lit;
 	if( c == '\\' )
 	{
-		lit += "\\\\";
+		out << "\\\\";
 	}
 	else if( c == quote )
 	{
-		lit += '\\';
-		lit += quote;
+		out << '\\';
+		out << quote;
 	}
 	else if( (unsigned char)c >= 0x20 )
 	{
-		lit += c;
+		out << c;
 	}
 	else if( c == '\n' )
 	{
-		lit += "\\n";
+		out << "\\n";
 	}
 	else if( c == '\t' )
 	{
-		lit += "\\t";
+		out << "\\t";
 	}
 	else if( c == '\r' )
 	{
-		lit += "\\r";
+		out << "\\r";
 	}
 	else
 	{
 		char hex[8];
 		snprintf( hex, sizeof( hex ), "\\x%02x", c );
-		lit += hex;
+		out << hex;
 	}
-
-	return lit;
 }
-
@@ -1,7 +1,9 @@
 #pragma once
 
-#include <sstream>
+#include <string>
+#include <string_view>
 #include "structurizer.h"
+#include "output-buffer.h"
 
 class CodeWriter : public StatementVisitor, public ILVisitor
 {
@@ -9,9 +11,13 @@ public:
 	CodeWriter( SmxFile& smx, const char* function );
 
 	std::string Build( Statement* stmt );
-	std::string BuildVarDecl( const std::string& var_name, const SmxVariableType* type );
-	std::string BuildFuncDecl( const std::string& func_name, const SmxFunctionSignature* sig );
-	std::string BuildTypedValue( cell_t* val, const SmxVariableType* type );
+	std::string BuildVarDecl( std::string_view var_name, const SmxVariableType* type );
+
+	// Same as above, but write straight into an output buffer
+	void Build( Statement* stmt, OutputBuffer& out );
+	void WriteVarDecl( OutputBuffer& out, std::string_view var_name, const SmxVariableType* type );
+	void WriteFuncDecl( OutputBuffer& out, std::string_view func_name, const SmxFunctionSignature* sig );
+	void WriteTypedValue( OutputBuffer& out, cell_t* val, const SmxVariableType* type );
 
 	virtual void VisitBasicStatement( BasicStatement* stmt ) override;
 	virtual void VisitIfStatement( IfStatement* stmt ) override;
@@ -40,21 +46,25 @@ public:
 	virtual void VisitNative( ILNative* node ) override;
 	virtual void VisitReturn( ILReturn* node ) override;
 	virtual void VisitPhi( ILPhi* node ) override;
-	virtual void VisitInterval( ILInterval* node ) override;
 private:
 	void Visit( Statement* stmt );
-	std::string Build( ILNode* node );
+	// Write the expression straight into code_
+	void Write( ILNode* node );
+	void WriteBinary( ILBinary* node, const char* op );
 
-	std::string Tabs();
+	std::string_view Tabs();
 	void Indent();
 	void Dedent();
 
-	std::string BuildStringLiteral( const char* str );
-	std::string BuildEscapedChar( char c, char quote );
+	void WriteStringLiteral( OutputBuffer& out, const char* str );
+	void WriteEscapedChar( OutputBuffer& out, char c, char quote );
+
+	OutputBuffer& code() { return *code_; }
 private:
 	SmxFile* smx_;
 	SmxFunction* func_;
-	std::stringstream code_;
+	OutputBuffer* code_ = nullptr;
+	std::string tabs_;
 	int indent_ = 0;
 	int level_ = 0;
 	bool in_else_if_ = false;
@@ -0,0 +1,328 @@
+#include "decompiler.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include "smx-disasm.h"
+#include "cfg-builder.h"
+#include "lifter.h"
+#include "il-disasm.h"
+#include "typer.h"
+#include "code-fixer.h"
+#include "code-writer.h"
+#include "smx-opcodes.h"
+#include "alloc-tracker.h"
+
+// Typing and fixing feed into each other, so keep running the passes until none of them changes
+// the IL anymore. A pass is only run again if something changed since it was last started.
+static void RunFixupPasses( Typer& typer, CodeFixer& fixer, ILControlFlowGraph& cfg )
+{
+	// Bail out eventually in case some pass keeps flip-flopping
+	constexpr int MAX_ROUNDS = 16;
+
+	PhaseTimer timer( Phase::FIXUP );
+	FunctionStats* stats = FunctionStats::current();
+
+	enum { POPULATE, FIX, PROPAGATE, NUM_PASSES };
+	size_t last_started[NUM_PASSES];
+	std::fill( std::begin( last_started ), std::end( last_started ), (size_t)-1 );
+
+	auto run = [&]( int pass ) {
+		size_t changes = typer.num_changes() + fixer.num_changes();
+		if( last_started[pass] == changes )
+			return false;
+		last_started[pass] = changes;
+
+		switch( pass )
+		{
+		case POPULATE: typer.PopulateTypes( cfg ); break;
+		case FIX: fixer.ApplyFixes( cfg ); break;
+		case PROPAGATE: typer.PropagateTypes( cfg ); break;
+		}
+		return true;
+	};
+
+	run( POPULATE );
+	for( int round = 0; round < MAX_ROUNDS; round++ )
+	{
+		bool ran = false;
+		for( int pass = 0; pass < NUM_PASSES; pass++ )
+			ran |= run( pass );
+
+		if( !ran )
+			break;
+		if( stats )
+			stats->num_fixup_rounds++;
+	}
+}
+
+static ILControlFlowGraph* LiftIL( SmxFile& smx, SmxFunction& func, OutputBuffer* il_out )
+{
+	CfgBuilder builder( smx );
+	ControlFlowGraph cfg = builder.Build( smx.code( func.pcode_start ) );
+
+	PcodeLifter lifter( smx );
+	ILControlFlowGraph* ilcfg = lifter.Lift( cfg );
+
+	if( il_out )
+	{
+		ILDisassembler ildisasm( smx );
+		ildisasm.DisassembleCFG( *ilcfg, *il_out );
+	}
+
+	return ilcfg;
+}
+
+void FixIL( SmxFile& smx, ILControlFlowGraph& ilcfg )
+{
+	Typer typer( smx );
+	CodeFixer fixer( smx );
+	RunFixupPasses( typer, fixer, ilcfg );
+}
+
+ILControlFlowGraph* BuildIL( SmxFile& smx, SmxFunction& func, OutputBuffer* il_out )
+{
+	ILControlFlowGraph* ilcfg = LiftIL( smx, func, il_out );
+	FixIL( smx, *ilcfg );
+	return ilcfg;
+}
+
+ILControlFlowGraph* LiftFunction( SmxFile& smx, SmxFunction& func, const DecompileOptions& options, OutputBuffer& out )
+{
+	if( options.assembly )
+	{
+		SmxDisassembler disasm( smx );
+		disasm.DisassembleFunction( func, out );
+		out << '\n';
+	}
+
+	return LiftIL( smx, func, options.il ? &out : nullptr );
+}
+
+void WriteFunction( SmxFile& smx, SmxFunction& func, Statement* func_stmt, OutputBuffer& out )
+{
+	CodeWriter writer( smx, func.name );
+	writer.Build( func_stmt, out );
+	out << '\n';
+}
+
+void DecompileFunction( SmxFile& smx, SmxFunction& func, const DecompileOptions& options, OutputBuffer& out,
+	FunctionStats* stats )
+{
+	TraceSpan span( "function", func.name );
+	if( stats )
+		stats->name = func.name;
+	FunctionStats::Scope use_stats( stats );
+
+	// Nodes are shared between statements, so they are only freed after the code is written
+	ILNodePool nodes;
+	ILNodePool::Scope use_nodes( nodes );
+
+	std::unique_ptr<ILControlFlowGraph> ilcfg( LiftFunction( smx, func, options, out ) );
+	FixIL( smx, *ilcfg );
+
+	Structurizer structurizer( ilcfg.get(), options.engine );
+	WriteFunction( smx, func, structurizer.Transform(), out );
+
+	if( stats )
+		CountNodes( nodes, *stats );
+}
+
+// Sizes up nodes by the class they were created as
+class NodeKindCounter : public ILVisitor
+{
+public:
+	explicit NodeKindCounter( std::map<std::string, AllocCount>& kinds ) : kinds_( &kinds ) {}
+
+	virtual void VisitConst( ILConst* node ) override { Count( "ILConst", sizeof( *node ) ); }
+	virtual void VisitUnary( ILUnary* node ) override { Count( "ILUnary", sizeof( *node ) ); }
+	virtual void VisitBinary( ILBinary* node ) override { Count( "ILBinary", sizeof( *node ) ); }
+	virtual void VisitLocalVar( ILLocalVar* node ) override { Count( "ILLocalVar", sizeof( *node ) ); }
+	virtual void VisitGlobalVar( ILGlobalVar* node ) override { Count( "ILGlobalVar", sizeof( *node ) ); }
+	virtual void VisitHeapVar( ILHeapVar* node ) override { Count( "ILHeapVar", sizeof( *node ) ); }
+	virtual void VisitArrayElementVar( ILArrayElementVar* node ) override { Count( "ILArrayElementVar", sizeof( *node ) ); }
+	virtual void VisitFieldVar( ILFieldVar* node ) override { Count( "ILFieldVar", sizeof( *node ) ); }
+	virtual void VisitTempVar( ILTempVar* node ) override { Count( "ILTempVar", sizeof( *node ) ); }
+	virtual void VisitLoad( ILLoad* node ) override { Count( "ILLoad", sizeof( *node ) ); }
+	virtual void VisitStore( ILStore* node ) override { Count( "ILStore", sizeof( *node ) ); }
+	virtual void VisitJump( ILJump* node ) override { Count( "ILJump", sizeof( *node ) ); }
+	virtual void VisitJumpCond( ILJumpCond* node ) override { Count( "ILJumpCond", sizeof( *node ) ); }
+	virtual void VisitSwitch( ILSwitch* node ) override { Count( "ILSwitch", sizeof( *node ) ); }
+	virtual void VisitCall( ILCall* node ) override { Count( "ILCall", sizeof( *node ) ); }
+	virtual void VisitNative( ILNative* node ) override { Count( "ILNative", sizeof( *node ) ); }
+	virtual void VisitReturn( ILReturn* node ) override { Count( "ILReturn", sizeof( *node ) ); }
+	virtual void VisitPhi( ILPhi* node ) override { Count( "ILPhi", sizeof( *node ) ); }
+private:
+	void Count( const char* kind, size_t size ) { (*kinds_)[kind].Add( size ); }
+private:
+	std::map<std::string, AllocCount>* kinds_;
+};
+
+void CountNodes( const ILNodePool& nodes, FunctionStats& stats )
+{
+	stats.num_il_nodes = nodes.num_nodes();
+	if( !AllocTracker::enabled() )
+		return;
+
+	// The counting allocates too, which isn't part of decompiling the function
+	FunctionStats::Scope no_stats( nullptr );
+	NodeKindCounter counter( stats.node_allocs );
+	for( size_t i = 0; i < nodes.num_nodes(); i++ )
+		nodes.node( i )->Accept( &counter );
+}
+
+uint64_t EstimateFunctionCost( const SmxFile& smx, const SmxFunction& func )
+{
+	// Every block goes through the dominator, interval and structuring passes, which makes blocks
+	// weigh more than straight-line code
+	constexpr uint64_t CELLS_PER_BLOCK = 16;
+
+	uint64_t num_blocks = 1;
+	const cell_t* instr = smx.code( func.pcode_start );
+	const cell_t* end = smx.code( func.pcode_end );
+	while( instr < end )
+	{
+		const auto& info = SmxInstrInfo::Get( instr[0] );
+		switch( instr[0] )
+		{
+			case SMX_OP_JUMP:
+			case SMX_OP_JEQ:
+			case SMX_OP_JNEQ:
+			case SMX_OP_JZER:
+			case SMX_OP_JNZ:
+			case SMX_OP_JSGRTR:
+			case SMX_OP_JSGEQ:
+			case SMX_OP_JSLESS:
+			case SMX_OP_JSLEQ:
+				num_blocks += 2;
+				break;
+			case SMX_OP_CASETBL:
+				num_blocks += instr[1] + 1;
+				instr += instr[1] * 2;
+				break;
+		}
+		instr += 1 + info.num_params;
+	}
+
+	return ( func.pcode_end - func.pcode_start ) / sizeof( cell_t ) + num_blocks * CELLS_PER_BLOCK;
+}
+
+void WriteGlobals( SmxFile& smx, OutputBuffer& out )
+{
+	CodeWriter writer( smx, "" );
+	for( size_t i = 0; i < smx.num_globals(); i++ )
+	{
+		SmxVariable& var = smx.global( i );
+		writer.WriteVarDecl( out, var.name, &var.type );
+		out << ";\n";
+	}
+	out << '\n';
+}
+
+std::vector<SmxFunction*> SelectFunctions( SmxFile& smx, const DecompileOptions& options )
+{
+	std::vector<SmxFunction*> funcs;
+	for( size_t i = 0; i < smx.num_functions(); i++ )
+	{
+		SmxFunction& func = smx.function( i );
+		if( options.function && strcmp( func.name, options.function ) != 0 )
+			continue;
+		funcs.push_back( &func );
+	}
+	return funcs;
+}
+
+OrderedOutput::OrderedOutput( OutputBuffer& out, size_t num_funcs, std::function<void()> done )
+	:
+	out_( out ),
+	done_( std::move( done ) ),
+	results_( num_funcs )
+{
+}
+
+void OrderedOutput::Finish( size_t index, std::unique_ptr<OutputBuffer> code )
+{
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		results_[index] = std::move( code );
+		while( next_to_write_ < results_.size() && results_[next_to_write_] )
+		{
+			out_.Write( results_[next_to_write_]->data(), results_[next_to_write_]->size() );
+			results_[next_to_write_].reset();
+			next_to_write_++;
+		}
+
+		if( next_to_write_ != results_.size() )
+			return;
+	}
+
+	done_();
+}
+
+// Functions of a file that are being decompiled on a scheduler
+struct FileJob
+{
+	SmxFile* smx;
+	DecompileOptions options;
+	std::vector<SmxFunction*> funcs;
+	std::unique_ptr<OrderedOutput> output;
+};
+
+void DecompileFileAsync( SmxFile& smx, const DecompileOptions& options, OutputBuffer& out,
+	TaskScheduler& scheduler, std::function<void()> done )
+{
+	if( options.globals )
+		WriteGlobals( smx, out );
+
+	auto job = std::make_shared<FileJob>();
+	job->smx = &smx;
+	job->options = options;
+	job->funcs = SelectFunctions( smx, options );
+	if( options.stats )
+		options.stats->functions.resize( job->funcs.size() );
+
+	if( job->funcs.empty() )
+	{
+		done();
+		return;
+	}
+	job->output = std::make_unique<OrderedOutput>( out, job->funcs.size(), std::move( done ) );
+
+	// Queue the largest functions first so they don't end up as stragglers
+	std::vector<std::pair<uint64_t, size_t>> order;
+	order.reserve( job->funcs.size() );
+	for( size_t i = 0; i < job->funcs.size(); i++ )
+		order.emplace_back( EstimateFunctionCost( smx, *job->funcs[i] ), i );
+	std::stable_sort( order.begin(), order.end(),
+		[]( const auto& a, const auto& b ) { return a.first > b.first; } );
+
+	for( const auto& [cost, index] : order )
+	{
+		scheduler.Submit( cost, [job, index = index] {
+			auto result = std::make_unique<OutputBuffer>();
+			FunctionStats* stats = job->options.stats ? &job->options.stats->functions[index] : nullptr;
+			DecompileFunction( *job->smx, *job->funcs[index], job->options, *result, stats );
+			job->output->Finish( index, std::move( result ) );
+		} );
+	}
+}
+
+void DecompileFile( SmxFile& smx, const DecompileOptions& options, OutputBuffer& out, TaskScheduler* scheduler )
+{
+	if( !scheduler )
+	{
+		if( options.globals )
+			WriteGlobals( smx, out );
+
+		std::vector<SmxFunction*> funcs = SelectFunctions( smx, options );
+		if( options.stats )
+			options.stats->functions.resize( funcs.size() );
+
+		for( size_t i = 0; i < funcs.size(); i++ )
+			DecompileFunction( smx, *funcs[i], options, out, options.stats ? &options.stats->functions[i] : nullptr );
+		return;
+	}
+
+	DecompileFileAsync( smx, options, out, *scheduler, [] {} );
+	scheduler->WaitAll();
+}
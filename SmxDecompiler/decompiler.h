@@ -0,0 +1,81 @@
+#pragma once
+
+#include "smx-file.h"
+#include "il-cfg.h"
+#include "structurizer.h"
+#include "output-buffer.h"
+#include "task-scheduler.h"
+#include "stats.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct DecompileOptions
+{
+	// Only decompile the function with this name
+	const char* function = nullptr;
+	bool globals = true;
+	bool assembly = false;
+	bool il = false;
+	StructurizerEngine engine = StructurizerEngine::INTERVALS;
+	// Collects the timings and counts of every selected function if set
+	FileStats* stats = nullptr;
+};
+
+// Lifts a function to IL and runs the typing and fixing passes on it. The freshly lifted IL is
+// disassembled into il_out if one is given. The nodes belong to the ILNodePool in use on the calling
+// thread, if there is one.
+ILControlFlowGraph* BuildIL( SmxFile& smx, SmxFunction& func, OutputBuffer* il_out );
+
+// The steps DecompileFunction goes through, for running them on different threads. Lifting writes
+// the assembly and the freshly lifted IL to out first if the options ask for them. The nodes belong
+// to the ILNodePool in use on the calling thread, if there is one.
+ILControlFlowGraph* LiftFunction( SmxFile& smx, SmxFunction& func, const DecompileOptions& options, OutputBuffer& out );
+void FixIL( SmxFile& smx, ILControlFlowGraph& ilcfg );
+void WriteFunction( SmxFile& smx, SmxFunction& func, Statement* func_stmt, OutputBuffer& out );
+
+// Runs the whole pipeline on one function and frees everything it allocated afterwards. Only reads
+// the shared SmxFile, so it is safe to run for several functions at once. Fills in stats if given.
+void DecompileFunction( SmxFile& smx, SmxFunction& func, const DecompileOptions& options, OutputBuffer& out,
+	FunctionStats* stats = nullptr );
+
+// Records how many nodes the pool holds and, while the AllocTracker runs, how much memory each kind
+// of node takes
+void CountNodes( const ILNodePool& nodes, FunctionStats& stats );
+
+// Relative cost of decompiling a function, estimated from its code size and number of blocks
+uint64_t EstimateFunctionCost( const SmxFile& smx, const SmxFunction& func );
+
+void WriteGlobals( SmxFile& smx, OutputBuffer& out );
+// The functions the options ask for, in file order
+std::vector<SmxFunction*> SelectFunctions( SmxFile& smx, const DecompileOptions& options );
+
+// Takes the code of functions that finish in any order and writes it to out in file order, each as
+// soon as everything before it is written. done is called after the last function.
+class OrderedOutput
+{
+public:
+	OrderedOutput( OutputBuffer& out, size_t num_funcs, std::function<void()> done );
+	OrderedOutput( const OrderedOutput& ) = delete;
+	OrderedOutput& operator=( const OrderedOutput& ) = delete;
+
+	void Finish( size_t index, std::unique_ptr<OutputBuffer> code );
+private:
+	OutputBuffer& out_;
+	std::function<void()> done_;
+	std::vector<std::unique_ptr<OutputBuffer>> results_;
+	size_t next_to_write_ = 0;
+	std::mutex mutex_;
+};
+
+// Writes the globals and every selected function of the file, in file order. With a scheduler the
+// functions are decompiled on its workers, largest first, and this waits for all of its tasks.
+void DecompileFile( SmxFile& smx, const DecompileOptions& options, OutputBuffer& out, TaskScheduler* scheduler = nullptr );
+
+// Writes the globals, queues the selected functions on the scheduler and returns. Their code is
+// written to out in file order as soon as it is ready, and done is called after the last one. The
+// file and out have to stay alive until then.
+void DecompileFileAsync( SmxFile& smx, const DecompileOptions& options, OutputBuffer& out,
+	TaskScheduler& scheduler, std::function<void()> done );
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include "il-cfg.h"
 
 #include "il.h"
+#include <algorithm>
 #include <cassert>
+#include <functional>
+#include <queue>
+#include <set>
 
 void ILControlFlowGraph::AddBlock( size_t id, cell_t pc )
 {
@@ -46,14 +50,20 @@ void ILControlFlowGraph::RemoveMultiple( ILBlock** blocks, size_t num_blocks )
 {
 	Verify();
 
+	std::vector<bool> remove( stable_blocks_.size(), false );
 	for( size_t block = 0; block < num_blocks; block++ )
 	{
-		auto it = std::find( stable_blocks_.begin(), stable_blocks_.end(), blocks[block] );
-		if( it != stable_blocks_.end() )
-		{
-			stable_blocks_.erase( it );
-		}
+		if( blocks[block]->id_ < stable_blocks_.size() && stable_blocks_[blocks[block]->id_] == blocks[block] )
+			remove[blocks[block]->id_] = true;
+	}
+
+	size_t num_kept = 0;
+	for( size_t i = 0; i < stable_blocks_.size(); i++ )
+	{
+		if( !remove[i] )
+			stable_blocks_[num_kept++] = stable_blocks_[i];
 	}
+	stable_blocks_.resize( num_kept );
 
 	for( size_t i = 0; i < stable_blocks_.size(); i++ )
 	{
@@ -67,8 +77,10 @@ void ILControlFlowGraph::ComputeDominance()
 {
 	for( ILBlock* b : stable_blocks_ )
 	{
-		b->SetImmediateDominator( nullptr );
-		b->SetImmediatePostDominator( nullptr );
+		b->idom_ = nullptr;
+		b->post_idom_ = nullptr;
+		b->dom_children_.clear();
+		b->post_dom_children_.clear();
 	}
 
 	// Compute immediate dominators
@@ -144,76 +156,35 @@ void ILControlFlowGraph::ComputeDominance()
 	Verify();
 }
 
-ILControlFlowGraph* ILControlFlowGraph::Next()
+void ILControlFlowGraph::MergeDominance( ILBlock& into, ILBlock& merged )
 {
-	std::vector<std::vector<ILBlock*>> intervals;
-
-	NewEpoch();
-
-	intervals.push_back( IntervalForHeader( block( 0 ) ) );
-
-	bool changed = true;
-	while( changed )
+	// Every path that went through `merged` now goes through `into` instead, which contracts
+	// `merged` out of both trees without changing the relation between any of the other blocks.
+	// Only the direct children of `merged` need to be moved
+	ILBlock* idom = merged.idom_ == &merged ? &into : merged.idom_;
+	if( into.idom_ == &merged )
+		into.SetImmediateDominator( idom );
+	// `into` is no longer among the children, so all of them move over to it in one go
+	for( ILBlock* child : merged.dom_children_ )
 	{
-		changed = false;
-
-		for( size_t i = 1; i < num_blocks(); i++ )
-		{
-			ILBlock& m = block( i );
-			if( m.IsVisited() )
-			{
-				continue;
-			}
-
-			for( size_t i = 0; i < m.num_in_edges(); i++ )
-			{
-				ILBlock& p = m.in_edge( i );
-				if( p.IsVisited() )
-				{
-					intervals.push_back( IntervalForHeader( m ) );
-					changed = true;
-					break;
-				}
-			}
-		}
+		assert( child != &into );
+		child->idom_ = &into;
 	}
-
-	ILControlFlowGraph* next = new ILControlFlowGraph;
-
-	// Add intervals to new graph
-	for( size_t i = 0; i < intervals.size(); i++ )
+	into.dom_children_.insert( into.dom_children_.end(), merged.dom_children_.begin(), merged.dom_children_.end() );
+	merged.dom_children_.clear();
+	merged.SetImmediateDominator( nullptr );
+
+	ILBlock* post_idom = merged.post_idom_ == &merged ? &into : merged.post_idom_;
+	if( into.post_idom_ == &merged )
+		into.SetImmediatePostDominator( post_idom );
+	for( ILBlock* child : merged.post_dom_children_ )
 	{
-		next->AddBlock( i, intervals[i][0]->pc() );
-		ILBlock& interval_block = next->block( i );
-		for( auto& block : intervals[i] )
-		{
-			interval_block.Add( new ILInterval( block ) );
-		}
-	}
-
-	// Calculate the edges
-	for( size_t i = 0; i < intervals.size(); i++ )
-	{
-		ILBlock* outer = &next->block( i );
-		for( size_t j = 0; j < intervals[i].size(); j++ )
-		{
-			ILBlock* inner = intervals[i][j];
-			for( size_t edge = 0; edge < inner->num_out_edges(); edge++ )
-			{
-				ILBlock* target = &inner->out_edge( edge );
-
-				// Find the outer interval that corresponds to this edge
-				size_t outer_target_index = FindOuterTarget( intervals, target );
-				ILBlock* outer_target = &next->block( outer_target_index );
-				if( outer_target != outer )
-				{
-					outer->AddTarget( *outer_target );
-				}
-			}
-		}
+		assert( child != &into );
+		child->post_idom_ = &into;
 	}
-
-	return next;
+	into.post_dom_children_.insert( into.post_dom_children_.end(), merged.post_dom_children_.begin(), merged.post_dom_children_.end() );
+	merged.post_dom_children_.clear();
+	merged.SetImmediatePostDominator( nullptr );
 }
 
 ILBlock* ILControlFlowGraph::Intersect( ILBlock& b1, ILBlock& b2 )
@@ -260,81 +231,293 @@ ILBlock* ILControlFlowGraph::IntersectPost( ILBlock& b1, ILBlock& b2 )
 	return finger1;
 }
 
-std::vector<ILBlock*> ILControlFlowGraph::IntervalForHeader( ILBlock& header )
+void ILControlFlowGraph::Verify()
 {
-	std::vector<ILBlock*> I;
-	I.push_back( &header );
-	header.SetVisited();
-	for( size_t i = 1; i < num_blocks(); i++ )
+#ifdef _DEBUG
+	// Make sure there are no dangling edges from removed blocks
+	for( ILBlock* b : stable_blocks_ )
 	{
-		ILBlock& m = block( i );
-		if( m.IsVisited() )
+		for( size_t i = 0; i < b->num_in_edges(); i++ )
 		{
-			continue;
+			assert( std::find( stable_blocks_.begin(), stable_blocks_.end(), &b->in_edge( i ) ) != stable_blocks_.end() );
 		}
+		for( size_t i = 0; i < b->num_out_edges(); i++ )
+		{
+			assert( std::find( stable_blocks_.begin(), stable_blocks_.end(), &b->out_edge( i ) ) != stable_blocks_.end() );
+		}
+	}
+
+	// Make sure the dominator trees don't reference removed blocks either
+	for( ILBlock* b : stable_blocks_ )
+	{
+		assert( !b->immed_dominator() ||
+			std::find( stable_blocks_.begin(), stable_blocks_.end(), b->immed_dominator() ) != stable_blocks_.end() );
+		assert( !b->immed_post_dominator() ||
+			std::find( stable_blocks_.begin(), stable_blocks_.end(), b->immed_post_dominator() ) != stable_blocks_.end() );
+	}
+#endif
+}
+
+void ILControlFlowGraph::NewEpoch()
+{
+	epoch_++;
+}
+
+void ILBlock::Add( ILNode* node )
+{
+	nodes_.push_back( node );
+	Renumber( nodes_.size() - 1 );
+}
+
+void ILBlock::Insert( size_t index, ILNode* node )
+{
+	nodes_.insert( nodes_.begin() + index, node );
+	Renumber( index );
+}
+
+void ILBlock::Remove( ILNode* node )
+{
+	auto it = std::find( nodes_.begin(), nodes_.end(), node );
+	if( it != nodes_.end() )
+	{
+		Remove( it - nodes_.begin() );
+	}
+}
+
+void ILBlock::Remove( size_t index )
+{
+	Detach( nodes_[index] );
+	nodes_.erase( nodes_.begin() + index );
+	Renumber( index );
+}
+
+void ILBlock::Replace( size_t index, ILNode* value )
+{
+	Detach( nodes_[index] );
+	nodes_[index] = value;
+	value->block_ = this;
+	value->index_ = (uint32_t)index;
+}
+
+void ILBlock::MarkRemoved( size_t index )
+{
+	Detach( nodes_[index] );
+	nodes_[index] = nullptr;
+	has_removed_ = true;
+}
+
+ILDerivedSequence::ILDerivedSequence( ILControlFlowGraph& cfg )
+{
+	size_t num_nodes = cfg.num_blocks();
 
-		bool add_to_interval = true;
-		for( size_t j = 0; j < m.num_in_edges(); j++ )
+	Level& first = levels_.emplace_back();
+	Edges preds( num_nodes );
+	Edges succs( num_nodes );
+	for( size_t i = 0; i < num_nodes; i++ )
+	{
+		ILBlock& bb = cfg.block( i );
+		first.headers.push_back( &bb );
+		for( size_t j = 0; j < bb.num_in_edges(); j++ )
+			preds[i].push_back( bb.in_edge( j ).id() );
+		for( size_t j = 0; j < bb.num_out_edges(); j++ )
+			succs[i].push_back( bb.out_edge( j ).id() );
+	}
+
+	std::vector<size_t> owner;
+	std::vector<size_t> headers;
+	while( true )
+	{
+		size_t num_intervals = FindIntervals( preds, succs, owner, headers );
+		if( num_intervals == num_nodes )
+			break;
+
+		// Collapse the edges into the next graph, dropping the ones within an interval
+		Edges next_preds( num_intervals );
+		Edges next_succs( num_intervals );
+		for( size_t node = 0; node < num_nodes; node++ )
 		{
-			ILBlock* p = &m.in_edge( j );
-			if( std::find( I.begin(), I.end(), p ) == I.end() )
+			for( size_t succ : succs[node] )
 			{
-				add_to_interval = false;
-				break;
+				if( owner[node] != owner[succ] )
+				{
+					next_succs[owner[node]].push_back( owner[succ] );
+					next_preds[owner[succ]].push_back( owner[node] );
+				}
 			}
 		}
 
-		if( add_to_interval )
+		const Level& prev = levels_.back();
+		Level next;
+		next.headers.reserve( num_intervals );
+		for( size_t header : headers )
+			next.headers.push_back( prev.headers[header] );
+		next.owners = std::move( owner );
+		levels_.push_back( std::move( next ) );
+
+		preds = std::move( next_preds );
+		succs = std::move( next_succs );
+		num_nodes = num_intervals;
+	}
+}
+
+size_t ILDerivedSequence::FindIntervals( const Edges& preds, const Edges& succs, std::vector<size_t>& owner, std::vector<size_t>& headers ) const
+{
+	constexpr size_t NONE = (size_t)-1;
+	size_t num_nodes = preds.size();
+	owner.assign( num_nodes, NONE );
+	headers.clear();
+
+	// Nodes that are not in an interval yet but have a predecessor that is. Headers are picked from
+	// here by sweeping over the nodes in order, starting over from the top once the end is reached
+	std::set<size_t> ready;
+	std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> candidates;
+
+	auto add = [&]( size_t node, size_t interval ) {
+		owner[node] = interval;
+		ready.erase( node );
+		for( size_t succ : succs[node] )
+		{
+			if( owner[succ] == NONE )
+				ready.insert( succ );
+		}
+	};
+
+	size_t header = 0;
+	while( true )
+	{
+		size_t interval = headers.size();
+		headers.push_back( header );
+		add( header, interval );
+
+		// A node joins the interval when all of its predecessors are in it. Nodes are checked once in
+		// ascending order, so only successors further down are candidates after a node is added
+		for( size_t succ : succs[header] )
 		{
-			I.push_back( &m );
-			m.SetVisited();
+			if( succ != 0 )
+				candidates.push( succ );
 		}
+
+		size_t last = NONE;
+		while( !candidates.empty() )
+		{
+			size_t m = candidates.top();
+			candidates.pop();
+			if( m == last || owner[m] != NONE )
+				continue;
+			last = m;
+
+			bool add_to_interval = true;
+			for( size_t pred : preds[m] )
+			{
+				if( owner[pred] != interval )
+				{
+					add_to_interval = false;
+					break;
+				}
+			}
+
+			if( add_to_interval )
+			{
+				add( m, interval );
+				for( size_t succ : succs[m] )
+				{
+					if( succ > m )
+						candidates.push( succ );
+				}
+			}
+		}
+
+		if( ready.empty() )
+			break;
+
+		auto it = ready.lower_bound( header + 1 );
+		if( it == ready.end() )
+			it = ready.begin();
+		header = *it;
 	}
 
-	return I;
+	return headers.size();
 }
 
-size_t ILControlFlowGraph::FindOuterTarget( const std::vector<std::vector<ILBlock*>> intervals, ILBlock* target )
+void ILBlock::ApplyEdits()
 {
-	for( size_t i = 0; i < intervals.size(); i++ )
+	if( queued_inserts_.empty() )
 	{
-		if( std::find( intervals[i].begin(), intervals[i].end(), target ) != intervals[i].end() )
-			return i;
+		if( has_removed_ )
+		{
+			nodes_.erase( std::remove( nodes_.begin(), nodes_.end(), nullptr ), nodes_.end() );
+			Renumber( 0 );
+		}
+		has_removed_ = false;
+		return;
 	}
 
-	return (size_t)-1;
+	// Inserts queued at the same index keep the order they were queued in
+	std::stable_sort( queued_inserts_.begin(), queued_inserts_.end(), []( const auto& a, const auto& b ) {
+		return a.first < b.first;
+	} );
+
+	std::vector<ILNode*> nodes;
+	nodes.reserve( nodes_.size() + queued_inserts_.size() );
+	size_t insert = 0;
+	for( size_t i = 0; i <= nodes_.size(); i++ )
+	{
+		while( insert < queued_inserts_.size() && queued_inserts_[insert].first == i )
+			nodes.push_back( queued_inserts_[insert++].second );
+
+		if( i < nodes_.size() && nodes_[i] )
+			nodes.push_back( nodes_[i] );
+	}
+	assert( insert == queued_inserts_.size() );
+
+	nodes_.swap( nodes );
+	queued_inserts_.clear();
+	has_removed_ = false;
+	Renumber( 0 );
 }
 
-void ILControlFlowGraph::Verify()
+void ILBlock::Renumber( size_t from )
 {
-#ifdef _DEBUG
-	// Make sure there are no dangling edges from removed blocks
-	for( ILBlock* b : stable_blocks_ )
+	for( size_t i = from; i < nodes_.size(); i++ )
 	{
-		for( size_t i = 0; i < b->num_in_edges(); i++ )
-		{
-			assert( std::find( stable_blocks_.begin(), stable_blocks_.end(), &b->in_edge( i ) ) != stable_blocks_.end() );
-		}
-		for( size_t i = 0; i < b->num_out_edges(); i++ )
-		{
-			assert( std::find( stable_blocks_.begin(), stable_blocks_.end(), &b->out_edge( i ) ) != stable_blocks_.end() );
-		}
+		nodes_[i]->block_ = this;
+		nodes_[i]->index_ = (uint32_t)i;
 	}
-#endif
 }
 
-void ILControlFlowGraph::NewEpoch()
+void ILBlock::Detach( ILNode* node )
 {
-	epoch_++;
+	// The node may have been moved to another block already
+	if( node && node->block_ == this )
+		node->block_ = nullptr;
 }
 
-void ILBlock::Remove( ILNode* node )
+void ILBlock::SetImmediateDominator( ILBlock* block )
 {
-	auto it = std::find( nodes_.begin(), nodes_.end(), node );
-	if( it != nodes_.end() )
+	if( idom_ && idom_ != this )
 	{
-		nodes_.erase( it );
+		auto it = std::find( idom_->dom_children_.begin(), idom_->dom_children_.end(), this );
+		if( it != idom_->dom_children_.end() )
+			idom_->dom_children_.erase( it );
 	}
+
+	idom_ = block;
+	if( block && block != this )
+		block->dom_children_.push_back( this );
+}
+
+void ILBlock::SetImmediatePostDominator( ILBlock* block )
+{
+	if( post_idom_ && post_idom_ != this )
+	{
+		auto it = std::find( post_idom_->post_dom_children_.begin(), post_idom_->post_dom_children_.end(), this );
+		if( it != post_idom_->post_dom_children_.end() )
+			post_idom_->post_dom_children_.erase( it );
+	}
+
+	post_idom_ = block;
+	if( block && block != this )
+		block->post_dom_children_.push_back( this );
 }
 
 void ILBlock::ReplaceOutEdge( ILBlock& from_block, ILBlock& to_block )
@@ -396,7 +579,7 @@ void ILBlock::AddInEdge( ILBlock& block )
 
 void ILBlock::AddToStart( ILNode* node )
 {
-	nodes_.insert( nodes_.begin(), node );
+	Insert( 0, node );
 }
 
 void ILBlock::AddToEnd( ILNode* node )
@@ -404,11 +587,11 @@ void ILBlock::AddToEnd( ILNode* node )
 	if( !nodes_.empty() &&
 		(dynamic_cast<ILJump*>(nodes_.back()) || dynamic_cast<ILJumpCond*>(nodes_.back()) || dynamic_cast<ILReturn*>(nodes_.back())) )
 	{
-		nodes_.insert( nodes_.end() - 1, node );
+		Insert( nodes_.size() - 1, node );
 	}
 	else
 	{
-		nodes_.push_back( node );
+		Add( node );
 	}
 }
 
@@ -14,11 +14,17 @@ public:
 		pc_( pc )
 	{}
 
-	void Add( ILNode* node ) { nodes_.push_back( node ); }
-	void Insert( size_t index, ILNode* node ) { nodes_.insert( nodes_.begin() + index, node ); }
+	// Every edit keeps ILNode::block() and ILNode::index() of the statements up to date
+	void Add( ILNode* node );
+	void Insert( size_t index, ILNode* node );
 	void Remove( ILNode* node );
-	void Remove( size_t index ) { nodes_.erase( nodes_.begin() + index ); }
-	void Replace( size_t index, ILNode* value ) { nodes_[index] = value; }
+	void Remove( size_t index );
+	void Replace( size_t index, ILNode* value );
+	// Batched editing for passes that rewrite many nodes of a block. Indices always refer to the
+	// node list as it was before the batch, removed nodes read as null until ApplyEdits() is called
+	void MarkRemoved( size_t index );
+	void QueueInsert( size_t index, ILNode* node ) { queued_inserts_.emplace_back( index, node ); }
+	void ApplyEdits();
 	void ReplaceOutEdge( ILBlock& from_block, ILBlock& to_block );
 	void ReplaceInEdge( ILBlock& from_block, ILBlock& to_block );
 	void RemoveOutEdge( ILBlock& block );
@@ -39,10 +45,14 @@ public:
 	size_t num_out_edges() const { return out_edges_.size(); }
 	ILBlock& out_edge( size_t index ) const { return *out_edges_[index]; }
 
-	void SetImmediateDominator( ILBlock* block ) { idom_ = block; }
+	void SetImmediateDominator( ILBlock* block );
 	ILBlock* immed_dominator() const { return idom_; }
-	void SetImmediatePostDominator( ILBlock* block ) { post_idom_ = block; }
+	void SetImmediatePostDominator( ILBlock* block );
 	ILBlock* immed_post_dominator() const { return post_idom_; }
+	size_t num_dom_children() const { return dom_children_.size(); }
+	ILBlock& dom_child( size_t index ) const { return *dom_children_[index]; }
+	size_t num_post_dom_children() const { return post_dom_children_.size(); }
+	ILBlock& post_dom_child( size_t index ) const { return *post_dom_children_[index]; }
 
 	bool Dominates( ILBlock* block ) const;
 	size_t NumDominators() const;
@@ -55,15 +65,23 @@ public:
 private:
 	friend class ILControlFlowGraph;
 
+	void Renumber( size_t from );
+	void Detach( ILNode* node );
+
 	const ILControlFlowGraph* cfg_;
 	cell_t pc_;
 	size_t id_ = 0;
 	int epoch_ = 0;
 	std::vector<ILNode*> nodes_;
+	bool has_removed_ = false;
+	std::vector<std::pair<size_t, ILNode*>> queued_inserts_;
 	std::vector<ILBlock*> in_edges_;
 	std::vector<ILBlock*> out_edges_;
 	ILBlock* idom_ = nullptr;
 	ILBlock* post_idom_ = nullptr;
+	// Children in the dominator/post-dominator trees, kept in sync by the setters above
+	std::vector<ILBlock*> dom_children_;
+	std::vector<ILBlock*> post_dom_children_;
 };
 
 class ILControlFlowGraph
@@ -86,18 +104,47 @@ public:
 	int epoch() const { return epoch_; }
 	void NewEpoch();
 
+	// Nodes that were changed by a pass, so passes that already ran over the graph only need to
+	// revisit the statements containing them
+	void MarkDirty( ILNode* node ) { dirty_nodes_.push_back( node ); }
+	void TakeDirty( std::vector<ILNode*>& nodes ) { nodes.swap( dirty_nodes_ ); dirty_nodes_.clear(); }
+
 	void ComputeDominance();
+	void MergeDominance( ILBlock& into, ILBlock& merged );
 	void Verify();
-
-	ILControlFlowGraph* Next();
 private:
 	ILBlock* Intersect( ILBlock& b1, ILBlock& b2 );
 	ILBlock* IntersectPost( ILBlock& b1, ILBlock& b2 );
-	std::vector<ILBlock*> IntervalForHeader( ILBlock& header );
-	size_t FindOuterTarget( const std::vector<std::vector<ILBlock*>> intervals, ILBlock* target );
 private:
 	int nargs_ = 0;
 	std::vector<ILBlock> blocks_;
 	std::vector<ILBlock*> stable_blocks_;
 	int epoch_ = 0;
+	std::vector<ILNode*> dirty_nodes_;
+};
+
+// Derived sequence of interval graphs G^0 ... G^n, where G^0 is the graph itself. Instead of
+// building a new graph for every level, each level only records which of its intervals every node
+// of the previous level belongs to, and the header block of every interval.
+class ILDerivedSequence
+{
+public:
+	ILDerivedSequence( ILControlFlowGraph& cfg );
+
+	size_t num_levels() const { return levels_.size(); }
+	size_t num_intervals( size_t level ) const { return levels_[level].headers.size(); }
+	ILBlock& header( size_t level, size_t interval ) const { return *levels_[level].headers[interval]; }
+	// Interval of the level that the given node of the previous level belongs to, level must be > 0
+	size_t owner( size_t level, size_t node ) const { return levels_[level].owners[node]; }
+private:
+	using Edges = std::vector<std::vector<size_t>>;
+	size_t FindIntervals( const Edges& preds, const Edges& succs, std::vector<size_t>& owner, std::vector<size_t>& headers ) const;
+private:
+	struct Level
+	{
+		// Interval of each node of the previous level, empty for G^0
+		std::vector<size_t> owners;
+		std::vector<ILBlock*> headers;
+	};
+	std::vector<Level> levels_;
 };
\ No newline at end of file
@@ -7,56 +7,74 @@ ILDisassembler::ILDisassembler( SmxFile& smx )
 
 std::string ILDisassembler::DisassembleNode( ILNode* node )
 {
-	disasm_.str( {} );
-	disasm_.clear();
-	VisitTopLevel( node );
-	return disasm_.str();
+	OutputBuffer out;
+	DisassembleNode( node, out );
+	return out.str();
 }
 
 std::string ILDisassembler::DisassembleBlock( const ILBlock& block )
+{
+	OutputBuffer out;
+	DisassembleBlock( block, out );
+	return out.str();
+}
+
+std::string ILDisassembler::DisassembleCFG( const ILControlFlowGraph& cfg )
+{
+	OutputBuffer out;
+	DisassembleCFG( cfg, out );
+	return out.str();
+}
+
+void ILDisassembler::DisassembleNode( ILNode* node, OutputBuffer& out )
+{
+	disasm_ = &out;
+	VisitTopLevel( node );
+	disasm_ = nullptr;
+}
+
+void ILDisassembler::DisassembleBlock( const ILBlock& block, OutputBuffer& out )
 {
 	func_ = smx_->FindFunctionAt( block.pc() );
 
-	std::stringstream block_disasm;
 	for( size_t node = 0; node < block.num_nodes(); node++ )
 	{
-		block_disasm << DisassembleNode( block.node( node ) ) << '\n';
+		DisassembleNode( block.node( node ), out );
+		out << '\n';
 	}
-	return block_disasm.str();
 }
 
-std::string ILDisassembler::DisassembleCFG( const ILControlFlowGraph& cfg )
+void ILDisassembler::DisassembleCFG( const ILControlFlowGraph& cfg, OutputBuffer& out )
 {
-	std::ostringstream cfg_disasm;
 	for( size_t i = 0; i < cfg.num_blocks(); i++ )
 	{
 		const ILBlock& bb = cfg.block( i );
-		cfg_disasm << "===== BB" << bb.id() << " =====\n";
+		out << "===== BB" << bb.id() << " =====\n";
 		for( size_t in = 0; in < bb.num_in_edges(); in++ )
 		{
-			cfg_disasm << "> Incoming edge: BB" << bb.in_edge( in ).id() << '\n';
+			out << "> Incoming edge: BB" << bb.in_edge( in ).id() << '\n';
 		}
-		for( size_t out = 0; out < bb.num_out_edges(); out++ )
+		for( size_t edge = 0; edge < bb.num_out_edges(); edge++ )
 		{
-			cfg_disasm << "> Outgoing edge: BB" << bb.out_edge( out ).id() << '\n';
+			out << "> Outgoing edge: BB" << bb.out_edge( edge ).id() << '\n';
 		}
 		for( ILBlock* p = bb.immed_dominator(); ; p = p->immed_dominator() )
 		{
-			cfg_disasm << "> Dominator: BB" << p->id() << '\n';
+			out << "> Dominator: BB" << p->id() << '\n';
 			if( p == p->immed_dominator() )
 			{
 				break;
 			}
 		}
 
-		cfg_disasm << DisassembleBlock( bb ) << '\n';
+		DisassembleBlock( bb, out );
+		out << '\n';
 	}
-	return cfg_disasm.str();
 }
 
 void ILDisassembler::VisitConst( ILConst* node )
 {
-	disasm_ << node->value();
+	disasm() << node->value();
 }
 
 void ILDisassembler::VisitUnary( ILUnary* node )
@@ -64,13 +82,13 @@ void ILDisassembler::VisitUnary( ILUnary* node )
 	switch( node->op() )
 	{
 		case ILUnary::NOT:
-			disasm_ << "!" << Visit( node->val() );
+			disasm() << "!" << Visit( node->val() );
 			break;
 		case ILUnary::NEG:
-			disasm_ << "-" << Visit( node->val() );
+			disasm() << "-" << Visit( node->val() );
 			break;
 		case ILUnary::INVERT:
-			disasm_ << "~" << Visit( node->val() );
+			disasm() << "~" << Visit( node->val() );
 			break;
 
 		case ILUnary::FABS:
@@ -80,14 +98,14 @@ void ILDisassembler::VisitUnary( ILUnary* node )
 		case ILUnary::RND_TO_CEIL:
 		case ILUnary::RND_TO_ZERO:
 		case ILUnary::RND_TO_FLOOR:
-			disasm_ << "<err>";
+			disasm() << "<err>";
 			break;
 
 		case ILUnary::INC:
-			disasm_ << "++" << Visit( node->val() );
+			disasm() << "++" << Visit( node->val() );
 			break;
 		case ILUnary::DEC:
-			disasm_ << "--" << Visit( node->val() );
+			disasm() << "--" << Visit( node->val() );
 			break;
 	}
 }
@@ -96,39 +114,39 @@ void ILDisassembler::VisitBinary( ILBinary* node )
 {
 	switch( node->op() )
 	{
-		case ILBinary::ADD:      disasm_ << Visit( node->left() ) << " + " << Visit( node->right() ); break;
-		case ILBinary::SUB:      disasm_ << Visit( node->left() ) << " - " << Visit( node->right() ); break;
-		case ILBinary::DIV:      disasm_ << Visit( node->left() ) << " / " << Visit( node->right() ); break;
-		case ILBinary::MUL:      disasm_ << Visit( node->left() ) << " * " << Visit( node->right() ); break;
-		case ILBinary::MOD:      disasm_ << Visit( node->left() ) << " % " << Visit( node->right() ); break;
-		case ILBinary::SHL:      disasm_ << Visit( node->left() ) << " << " << Visit( node->right() ); break;
-		case ILBinary::SHR:      disasm_ << Visit( node->left() ) << " >> " << Visit( node->right() ); break;
-		case ILBinary::SSHR:     disasm_ << Visit( node->left() ) << " >> " << Visit( node->right() ); break;
-		case ILBinary::BITAND:      disasm_ << Visit( node->left() ) << " & " << Visit( node->right() ); break;
-		case ILBinary::BITOR:       disasm_ << Visit( node->left() ) << " | " << Visit( node->right() ); break;
-		case ILBinary::XOR:      disasm_ << Visit( node->left() ) << " ^ " << Visit( node->right() ); break;
-
-		case ILBinary::EQ:       disasm_ << Visit( node->left() ) << " == " << Visit( node->right() ); break;
-		case ILBinary::NEQ:      disasm_ << Visit( node->left() ) << " != " << Visit( node->right() ); break;
-		case ILBinary::SGRTR:    disasm_ << Visit( node->left() ) << " > " << Visit( node->right() ); break;
-		case ILBinary::SGEQ:     disasm_ << Visit( node->left() ) << " >= " << Visit( node->right() ); break;
-		case ILBinary::SLESS:    disasm_ << Visit( node->left() ) << " < " << Visit( node->right() ); break;
-		case ILBinary::SLEQ:     disasm_ << Visit( node->left() ) << " <= " << Visit( node->right() ); break;
-		case ILBinary::AND:      disasm_ << Visit( node->left() ) << " && " << Visit( node->right() ); break;
-		case ILBinary::OR:       disasm_ << Visit( node->left() ) << " || " << Visit( node->right() ); break;
-
-		case ILBinary::FLOATADD: disasm_ << Visit( node->left() ) << " f+ " << Visit( node->right() ); break;
-		case ILBinary::FLOATSUB: disasm_ << Visit( node->left() ) << " f- " << Visit( node->right() ); break;
-		case ILBinary::FLOATMUL: disasm_ << Visit( node->left() ) << " f* " << Visit( node->right() ); break;
-		case ILBinary::FLOATDIV: disasm_ << Visit( node->left() ) << " f/ " << Visit( node->right() ); break;
-
-		case ILBinary::FLOATCMP: disasm_ << Visit( node->left() ) << " fcmp " << Visit( node->right() ); break;
-		case ILBinary::FLOATGT:  disasm_ << Visit( node->left() ) << " f> " << Visit( node->right() ); break;
-		case ILBinary::FLOATGE:  disasm_ << Visit( node->left() ) << " f>= " << Visit( node->right() ); break;
-		case ILBinary::FLOATLE:  disasm_ << Visit( node->left() ) << " f<= " << Visit( node->right() ); break;
-		case ILBinary::FLOATLT:  disasm_ << Visit( node->left() ) << " f< " << Visit( node->right() ); break;
-		case ILBinary::FLOATEQ:  disasm_ << Visit( node->left() ) << " f== " << Visit( node->right() ); break;
-		case ILBinary::FLOATNE:  disasm_ << Visit( node->left() ) << " f!= " << Visit( node->right() ); break;
+		case ILBinary::ADD:      disasm() << Visit( node->left() ) << " + " << Visit( node->right() ); break;
+		case ILBinary::SUB:      disasm() << Visit( node->left() ) << " - " << Visit( node->right() ); break;
+		case ILBinary::DIV:      disasm() << Visit( node->left() ) << " / " << Visit( node->right() ); break;
+		case ILBinary::MUL:      disasm() << Visit( node->left() ) << " * " << Visit( node->right() ); break;
+		case ILBinary::MOD:      disasm() << Visit( node->left() ) << " % " << Visit( node->right() ); break;
+		case ILBinary::SHL:      disasm() << Visit( node->left() ) << " << " << Visit( node->right() ); break;
+		case ILBinary::SHR:      disasm() << Visit( node->left() ) << " >> " << Visit( node->right() ); break;
+		case ILBinary::SSHR:     disasm() << Visit( node->left() ) << " >> " << Visit( node->right() ); break;
+		case ILBinary::BITAND:      disasm() << Visit( node->left() ) << " & " << Visit( node->right() ); break;
+		case ILBinary::BITOR:       disasm() << Visit( node->left() ) << " | " << Visit( node->right() ); break;
+		case ILBinary::XOR:      disasm() << Visit( node->left() ) << " ^ " << Visit( node->right() ); break;
+
+		case ILBinary::EQ:       disasm() << Visit( node->left() ) << " == " << Visit( node->right() ); break;
+		case ILBinary::NEQ:      disasm() << Visit( node->left() ) << " != " << Visit( node->right() ); break;
+		case ILBinary::SGRTR:    disasm() << Visit( node->left() ) << " > " << Visit( node->right() ); break;
+		case ILBinary::SGEQ:     disasm() << Visit( node->left() ) << " >= " << Visit( node->right() ); break;
+		case ILBinary::SLESS:    disasm() << Visit( node->left() ) << " < " << Visit( node->right() ); break;
+		case ILBinary::SLEQ:     disasm() << Visit( node->left() ) << " <= " << Visit( node->right() ); break;
+		case ILBinary::AND:      disasm() << Visit( node->left() ) << " && " << Visit( node->right() ); break;
+		case ILBinary::OR:       disasm() << Visit( node->left() ) << " || " << Visit( node->right() ); break;
+
+		case ILBinary::FLOATADD: disasm() << Visit( node->left() ) << " f+ " << Visit( node->right() ); break;
+		case ILBinary::FLOATSUB: disasm() << Visit( node->left() ) << " f- " << Visit( node->right() ); break;
+		case ILBinary::FLOATMUL: disasm() << Visit( node->left() ) << " f* " << Visit( node->right() ); break;
+		case ILBinary::FLOATDIV: disasm() << Visit( node->left() ) << " f/ " << Visit( node->right() ); break;
+
+		case ILBinary::FLOATCMP: disasm() << Visit( node->left() ) << " fcmp " << Visit( node->right() ); break;
+		case ILBinary::FLOATGT:  disasm() << Visit( node->left() ) << " f> " << Visit( node->right() ); break;
+		case ILBinary::FLOATGE:  disasm() << Visit( node->left() ) << " f>= " << Visit( node->right() ); break;
+		case ILBinary::FLOATLE:  disasm() << Visit( node->left() ) << " f<= " << Visit( node->right() ); break;
+		case ILBinary::FLOATLT:  disasm() << Visit( node->left() ) << " f< " << Visit( node->right() ); break;
+		case ILBinary::FLOATEQ:  disasm() << Visit( node->left() ) << " f== " << Visit( node->right() ); break;
+		case ILBinary::FLOATNE:  disasm() << Visit( node->left() ) << " f!= " << Visit( node->right() ); break;
 	}
 }
 
@@ -141,7 +159,7 @@ void ILDisassembler::VisitLocalVar( ILLocalVar* node )
 		{
 			if( func_->locals[i].address == node->stack_offset() )
 			{
-				disasm_ << func_->locals[i].name;
+				disasm() << func_->locals[i].name;
 				found_name = true;
 				break;
 			}
@@ -151,14 +169,14 @@ void ILDisassembler::VisitLocalVar( ILLocalVar* node )
 	if( !found_name )
 	{
 		if( node->stack_offset() < 0 )
-			disasm_ << "local_" << -node->stack_offset();
+			disasm() << "local_" << -node->stack_offset();
 		else
-			disasm_ << "arg" << ( node->stack_offset() / 4 - 3 + 1 );
+			disasm() << "arg" << ( node->stack_offset() / 4 - 3 + 1 );
 	}
 
 	if( node->value() && top_level_ )
 	{
-		disasm_ << " := " << Visit( node->value() );
+		disasm() << " := " << Visit( node->value() );
 	}
 }
 
@@ -166,149 +184,148 @@ void ILDisassembler::VisitGlobalVar( ILGlobalVar* node )
 {
 	if( SmxVariable* var = smx_->FindGlobalAt( node->addr() ) )
 	{
-		disasm_ << var->name;
+		disasm() << var->name;
 	}
 	else
 	{
-		disasm_ << "global_" << node->addr();
+		disasm() << "global_" << node->addr();
 	}
 }
 
 void ILDisassembler::VisitHeapVar( ILHeapVar* node )
 {
-	disasm_ << "heap_" << node->addr();
+	disasm() << "heap_" << node->addr();
 	if( top_level_ )
-		disasm_ << " := alloc(" << node->size() << ")";
+		disasm() << " := alloc(" << node->size() << ")";
 }
 
 void ILDisassembler::VisitArrayElementVar( ILArrayElementVar* node )
 {
-	disasm_ << Visit( node->base() ) << "[" << Visit( node->index() ) << "]";
+	disasm() << Visit( node->base() ) << "[" << Visit( node->index() ) << "]";
 }
 
 void ILDisassembler::VisitFieldVar( ILFieldVar* node )
 {
-	std::string field;
+	disasm() << Visit( node->base() ) << '.';
 	if( node->field() )
 	{
-		field = node->field()->name;
+		disasm() << node->field()->name;
 	}
 	else
 	{
-		field = "field_" + std::to_string( node->offset() );
+		disasm() << "field_" << node->offset();
 	}
-	disasm_ << Visit( node->base() ) << '.' << field;
 }
 
 void ILDisassembler::VisitTempVar( ILTempVar* node )
 {
-	disasm_ << "tmp_" << node->index();
+	disasm() << "tmp_" << node->index();
 	if( node->value() && top_level_ )
 	{
-		disasm_ << " := " << Visit( node->value() );
+		disasm() << " := " << Visit( node->value() );
 	}
 }
 
 void ILDisassembler::VisitLoad( ILLoad* node )
 {
-	disasm_ << Visit( node->var() );
+	disasm() << Visit( node->var() );
 }
 
 void ILDisassembler::VisitStore( ILStore* node )
 {
-	disasm_ << Visit( node->var() ) << " = " << Visit( node->val() );
+	disasm() << Visit( node->var() ) << " = " << Visit( node->val() );
 }
 
 void ILDisassembler::VisitJump( ILJump* node )
 {
-	disasm_ << "goto BB" << node->target()->id();
+	disasm() << "goto BB" << node->target()->id();
 }
 
 void ILDisassembler::VisitJumpCond( ILJumpCond* node )
 {
-	disasm_ << "if " << Visit( node->condition() ) << " goto BB" << node->true_branch()->id() << " else BB" << node->false_branch()->id();
+	disasm() << "if " << Visit( node->condition() ) << " goto BB" << node->true_branch()->id() << " else BB" << node->false_branch()->id();
 }
 
 void ILDisassembler::VisitSwitch( ILSwitch* node )
 {
-	disasm_ << "switch " << Visit( node->value() );
+	disasm() << "switch " << Visit( node->value() );
 	for( size_t i = 0; i < node->num_cases(); i++ )
 	{
-		disasm_ << "\ncase " << node->case_entry( i ).value << " goto BB" << node->case_entry( i ).address->id();
+		disasm() << "\ncase " << node->case_entry( i ).value << " goto BB" << node->case_entry( i ).address->id();
 	}
 	
 	if( node->default_case() )
-		disasm_ << "\ndefault goto BB" << node->default_case()->id();
+		disasm() << "\ndefault goto BB" << node->default_case()->id();
 }
 
 void ILDisassembler::VisitCall( ILCall* node )
 {
 	if( SmxFunction* func = smx_->FindFunctionAt( node->addr() ) )
 	{
-		disasm_ << func->name;
+		disasm() << func->name;
 	}
 	else
 	{
-		disasm_ << "func_" << node->addr();
+		disasm() << "func_" << node->addr();
 	}
 
-	disasm_ << "(";
+	disasm() << "(";
 	for( size_t i = 0; i < node->num_args(); i++ )
 	{
-		disasm_ << Visit( node->arg( i ) );
+		disasm() << Visit( node->arg( i ) );
 		if( i != node->num_args() - 1 )
 		{
-			disasm_ << ", ";
+			disasm() << ", ";
 		}
 	}
-	disasm_ << ")";
+	disasm() << ")";
 }
 
 void ILDisassembler::VisitNative( ILNative* node )
 {
 	if( SmxNative* native = smx_->FindNativeByIndex( node->native_index() ) )
 	{
-		disasm_ << native->name;
+		disasm() << native->name;
 	}
 	else
 	{
-		disasm_ << "native_" << node->native_index();
+		disasm() << "native_" << node->native_index();
 	}
 
-	disasm_ << "(";
+	disasm() << "(";
 	for( size_t i = 0; i < node->num_args(); i++ )
 	{
-		disasm_ << Visit( node->arg( i ) );
+		disasm() << Visit( node->arg( i ) );
 		if( i != node->num_args() - 1 )
 		{
-			disasm_ << ", ";
+			disasm() << ", ";
 		}
 	}
-	disasm_ << ")";
+	disasm() << ")";
 }
 
 void ILDisassembler::VisitReturn( ILReturn* node )
 {
-	disasm_ << "return";
+	disasm() << "return";
 	if( node->value() )
-		disasm_ << " " << Visit(node->value());
+		disasm() << " " << Visit(node->value());
 }
 
 void ILDisassembler::VisitPhi( ILPhi* node )
 {
-	disasm_ << "phi(";
+	disasm() << "phi(";
 	for( size_t i = 0; i < node->num_inputs(); i++ )
 	{
-		disasm_ << Visit( node->input( i ) );
+		disasm() << Visit( node->input( i ) );
 		if( i != node->num_inputs() - 1 )
 		{
-			disasm_ << ", ";
+			disasm() << ", ";
 		}
 	}
-	disasm_ << ")";
+	disasm() << ")";
 }
 
-std::string ILDisassembler::Visit( ILNode* node )
+const char* ILDisassembler::Visit( ILNode* node )
 {
 	bool old = top_level_;
 	top_level_ = false;
@@ -317,7 +334,7 @@ std::string ILDisassembler::Visit( ILNode* node )
 	return "";
 }
 
-std::string ILDisassembler::VisitTopLevel( ILNode* node )
+const char* ILDisassembler::VisitTopLevel( ILNode* node )
 {
 	bool old = top_level_;
 	top_level_ = true;
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "il.h"
-#include <sstream>
+#include "output-buffer.h"
+#include <string>
 
 class ILDisassembler : ILVisitor
 {
@@ -11,6 +12,10 @@ public:
 	std::string DisassembleNode( ILNode* node );
 	std::string DisassembleBlock( const ILBlock& block );
 	std::string DisassembleCFG( const ILControlFlowGraph& cfg );
+
+	void DisassembleNode( ILNode* node, OutputBuffer& out );
+	void DisassembleBlock( const ILBlock& block, OutputBuffer& out );
+	void DisassembleCFG( const ILControlFlowGraph& cfg, OutputBuffer& out );
 private:
 	virtual void VisitConst( ILConst* node ) override;
 	virtual void VisitUnary( ILUnary* node ) override;
@@ -31,11 +36,13 @@ private:
 	virtual void VisitReturn( ILReturn* node ) override;
 	virtual void VisitPhi( ILPhi* node ) override;
 
-	std::string Visit( ILNode* node );
-	std::string VisitTopLevel( ILNode* node );
+	const char* Visit( ILNode* node );
+	const char* VisitTopLevel( ILNode* node );
+
+	OutputBuffer& disasm() { return *disasm_; }
 private:
 	SmxFile* smx_;
 	SmxFunction* func_;
-	std::stringstream disasm_;
+	OutputBuffer* disasm_ = nullptr;
 	bool top_level_;
 };
\ No newline at end of file
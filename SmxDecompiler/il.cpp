@@ -1,5 +1,39 @@
 #include "il.h"
 
+thread_local ILNodePool* ILNodePool::current_ = nullptr;
+
+ILNode::ILNode()
+{
+	ILNodePool::Track( this );
+}
+
+ILNode::ILNode( const ILNode& other )
+	:
+	uses_( other.uses_ ),
+	type_( other.type_ )
+{
+	ILNodePool::Track( this );
+}
+
+ILNodePool::~ILNodePool()
+{
+	assert( current_ != this );
+	for( ILNode* node : nodes_ )
+		delete node;
+}
+
+ILNodePool::Scope::Scope( ILNodePool& pool )
+	:
+	prev_( current_ )
+{
+	current_ = &pool;
+}
+
+ILNodePool::Scope::~Scope()
+{
+	current_ = prev_;
+}
+
 class Inverter : public ILVisitor
 {
 public:
@@ -5,7 +5,9 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 
 class ILBlock;
 class ILConst;
@@ -26,7 +28,6 @@ class ILCall;
 class ILNative;
 class ILReturn;
 class ILPhi;
-class ILInterval;
 
 class ILVisitor
 {
@@ -51,12 +52,13 @@ public:
 	virtual void VisitNative( ILNative* node ) {}
 	virtual void VisitReturn( ILReturn* node ) {}
 	virtual void VisitPhi( ILPhi* node ) {}
-	virtual void VisitInterval( ILInterval* node ) {}
 };
 
 class ILNode
 {
 public:
+	ILNode();
+	ILNode( const ILNode& other );
 	virtual ~ILNode() = default;
 
 	void AddUse( ILNode* user ) { uses_.push_back( user ); }
@@ -79,12 +81,27 @@ public:
 	const SmxVariableType* type() const { return type_; }
 	void SetType( const SmxVariableType* type ) { type_ = type; }
 
+	// Block this node is a statement of and its index there, kept up to date by the block. Null
+	// for nodes that are only used by other nodes, or whose statement was removed
+	ILBlock* block() const { return block_; }
+	size_t index() const { return index_; }
+
+	// For walks that must reach every node only once: a node counts as visited by a walk when its
+	// mark is the epoch of that walk
+	bool IsMarked( uint32_t epoch ) const { return mark_ == epoch; }
+	void Mark( uint32_t epoch ) { mark_ = epoch; }
+
 	virtual void ReplaceParam( ILNode* target, ILNode* replacement ) {}
 
 	virtual void Accept( ILVisitor* visitor ) = 0;
 private:
+	friend class ILBlock;
+
 	std::vector<ILNode*> uses_;
-	const SmxVariableType* type_;
+	const SmxVariableType* type_ = nullptr;
+	ILBlock* block_ = nullptr;
+	uint32_t index_ = 0;
+	uint32_t mark_ = 0;
 };
 
 class ILConst : public ILNode
@@ -239,7 +256,7 @@ public:
 	SmxVariable* smx_var() const { return var_; }
 	void SetSmxVar( SmxVariable* var ) { var_ = var; }
 private:
-	SmxVariable* var_;
+	SmxVariable* var_ = nullptr;
 };
 
 class ILLocalVar : public ILVar
@@ -639,18 +656,6 @@ private:
 	std::vector<ILNode*> inputs_;
 };
 
-class ILInterval : public ILNode
-{
-public:
-	ILInterval( ILBlock* block ) : inner_( block ) {}
-	
-	ILBlock* block() { return inner_; }
-
-	virtual void Accept( ILVisitor* visitor ) { visitor->VisitInterval( this ); }
-private:
-	ILBlock* inner_;
-};
-
 class RecursiveILVisitor : public ILVisitor
 {
 protected:
@@ -705,4 +710,41 @@ protected:
 		if( node->value() )
 			node->value()->Accept( this );
 	}
+};
+
+// Owns every IL node created while it is in use on a thread, and frees them all together. Nodes
+// form a graph without clear ownership, so without a pool they are never freed.
+class ILNodePool
+{
+public:
+	ILNodePool() = default;
+	ILNodePool( const ILNodePool& ) = delete;
+	ILNodePool& operator=( const ILNodePool& ) = delete;
+	~ILNodePool();
+
+	// Puts the pool in use on the current thread until the scope ends. A pool may be used on
+	// different threads one after the other, but not on two at once.
+	class Scope
+	{
+	public:
+		explicit Scope( ILNodePool& pool );
+		Scope( const Scope& ) = delete;
+		Scope& operator=( const Scope& ) = delete;
+		~Scope();
+	private:
+		ILNodePool* prev_;
+	};
+
+	size_t num_nodes() const { return nodes_.size(); }
+	ILNode* node( size_t index ) const { return nodes_[index]; }
+
+	static void Track( ILNode* node )
+	{
+		if( current_ )
+			current_->nodes_.push_back( node );
+	}
+private:
+	std::vector<ILNode*> nodes_;
+
+	static thread_local ILNodePool* current_;
 };
\ No newline at end of file
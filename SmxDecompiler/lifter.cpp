@@ -2,10 +2,13 @@
 
 #include "il.h"
 #include "smx-opcodes.h"
+#include "stats.h"
 #include <cassert>
+#include <set>
 
 ILControlFlowGraph* PcodeLifter::Lift( const ControlFlowGraph& cfg )
 {
+	PhaseTimer timer( Phase::LIFT );
 	num_temps_ = 0;
 	heap_addr_ = 0;
 
@@ -44,11 +47,15 @@ ILControlFlowGraph* PcodeLifter::Lift( const ControlFlowGraph& cfg )
 		MovePhis( ilbb );
 	}
 
+	// Merges blocks and keeps the dominator trees up to date as it goes
 	CompoundConditions();
+	ilcfg_->Verify();
 
-	// All the operations above may have moved around some edges and removed basic blocks
-	// Recompute the dominance for the graph again in case there are stale references there
-	ilcfg_->ComputeDominance();
+	if( FunctionStats* stats = FunctionStats::current() )
+	{
+		stats->num_blocks = ilcfg_->num_blocks();
+		stats->num_temps = num_temps_;
+	}
 
 	return ilcfg_;
 }
@@ -89,6 +96,9 @@ void PcodeLifter::LiftBlock( BasicBlock& bb, ILBlock& ilbb )
 					phi = new ILPhi;
 					phi->AddInput( reg );
 					reg = phi;
+
+					if( FunctionStats* stats = FunctionStats::current() )
+						stats->num_phis++;
 				}
 				phi->AddInput( value );
 			};
@@ -812,10 +822,12 @@ void PcodeLifter::CleanCalls( ILBlock& ilbb )
 			{
 				// Just use call node directly at use site rather than going through temp var
 				var->ReplaceUsesWith( call );
-				ilbb.Remove( i );
+				ilbb.MarkRemoved( i );
 			}
 		}
 	}
+
+	ilbb.ApplyEdits();
 }
 
 void PcodeLifter::PruneVarsInBlock( ILBlock& ilbb )
@@ -826,10 +838,12 @@ void PcodeLifter::PruneVarsInBlock( ILBlock& ilbb )
 		{
 			if( var->num_uses() == 0 )
 			{
-				ilbb.Remove( i );
+				ilbb.MarkRemoved( i );
 			}
 		}
 	}
+
+	ilbb.ApplyEdits();
 }
 
 void PcodeLifter::MovePhis( ILBlock& ilbb )
@@ -854,54 +868,97 @@ void PcodeLifter::MovePhis( ILBlock& ilbb )
 				}
 
 				// Remove from current block
-				ilbb.Remove( i );
+				ilbb.MarkRemoved( i );
 			}
 		}
 	}
+
+	ilbb.ApplyEdits();
 }
 
 void PcodeLifter::CompoundConditions() const
 {
-	bool changed = true;
-	while( changed )
+	// Conditional blocks are visited in sweeps over the block order. A fold only requeues the
+	// blocks whose pattern could have changed, blocks behind the current one are picked up by the
+	// next sweep, so the result is the same as sweeping the entire graph until nothing changes
+	auto by_id = []( const ILBlock* a, const ILBlock* b ) { return a->id() < b->id(); };
+	std::set<ILBlock*, decltype( by_id )> worklist( by_id );
+	for( size_t i = 0; i < ilcfg_->num_blocks(); i++ )
 	{
-		changed = false;
+		ILBlock& bb = ilcfg_->block( i );
+		if( bb.num_out_edges() == 2 )
+			worklist.insert( &bb );
+	}
 
-		for( size_t i = 0; i < ilcfg_->num_blocks(); i++ )
+	auto requeue_preds = [&]( ILBlock& bb ) {
+		for( size_t i = 0; i < bb.num_in_edges(); i++ )
 		{
-			ILBlock& bb = ilcfg_->block( i );
-			if( bb.num_out_edges() != 2 || dynamic_cast<ILSwitch*>(bb.Last()) )
-				continue;
+			if( bb.in_edge( i ).num_out_edges() == 2 )
+				worklist.insert( &bb.in_edge( i ) );
+		}
+	};
 
-			ILBlock& then_branch = bb.out_edge( 0 );
-			ILBlock& else_branch = bb.out_edge( 1 );
+	// Merged blocks are only removed at the end, so block ids stay stable during the sweeps
+	std::vector<ILBlock*> removed;
+	ILBlock* cursor = nullptr;
+	while( !worklist.empty() )
+	{
+		auto it = cursor ? worklist.upper_bound( cursor ) : worklist.begin();
+		if( it == worklist.end() )
+			it = worklist.begin();
 
-			// X || Y
-			if( else_branch.num_out_edges() == 2 &&
-				else_branch.num_nodes() == 1 &&
-				else_branch.num_in_edges() == 1 &&
-				&else_branch.out_edge( 0 ) == &then_branch )
-			{
-				CompoundXandY( bb, else_branch, then_branch, else_branch.out_edge( 1 ) );
-				changed = true;
-			}
+		ILBlock& bb = **it;
+		worklist.erase( it );
+		cursor = &bb;
 
-			// X && Y
-			if( then_branch.num_out_edges() == 2 &&
-				then_branch.num_nodes() == 1 &&
-				then_branch.num_in_edges() == 1 &&
-				&then_branch.out_edge( 1 ) == &else_branch )
-			{
-				CompoundXorY( bb, then_branch, then_branch.out_edge( 0 ), else_branch );
-				changed = true;
-			}
+		if( bb.num_out_edges() != 2 || dynamic_cast<ILSwitch*>(bb.Last()) )
+			continue;
+
+		ILBlock& then_branch = bb.out_edge( 0 );
+		ILBlock& else_branch = bb.out_edge( 1 );
+		bool changed = false;
 
-			// 2 other cases also exist
-			// !X || Y
-			// !X && Y
-			// but these shouldn't be emitted by compiler
+		// X || Y
+		if( else_branch.num_out_edges() == 2 &&
+			else_branch.num_nodes() == 1 &&
+			else_branch.num_in_edges() == 1 &&
+			&else_branch.out_edge( 0 ) == &then_branch )
+		{
+			worklist.erase( &else_branch );
+			removed.push_back( &else_branch );
+			CompoundXandY( bb, else_branch, then_branch, else_branch.out_edge( 1 ) );
+			changed = true;
+		}
+
+		// X && Y
+		if( then_branch.num_out_edges() == 2 &&
+			then_branch.num_nodes() == 1 &&
+			then_branch.num_in_edges() == 1 &&
+			&then_branch.out_edge( 1 ) == &else_branch )
+		{
+			worklist.erase( &then_branch );
+			removed.push_back( &then_branch );
+			CompoundXorY( bb, then_branch, then_branch.out_edge( 0 ), else_branch );
+			changed = true;
+		}
+
+		// 2 other cases also exist
+		// !X || Y
+		// !X && Y
+		// but these shouldn't be emitted by compiler
+
+		if( changed )
+		{
+			// The folded block and anything branching to it or to its new targets may match now
+			worklist.insert( &bb );
+			requeue_preds( bb );
+			for( size_t i = 0; i < bb.num_out_edges(); i++ )
+				requeue_preds( bb.out_edge( i ) );
 		}
 	}
+
+	if( !removed.empty() )
+		ilcfg_->RemoveMultiple( removed.data(), removed.size() );
 }
 
 void PcodeLifter::CompoundXandY( ILBlock& x, ILBlock& y, ILBlock& then_branch, ILBlock& else_branch ) const
@@ -923,7 +980,7 @@ void PcodeLifter::CompoundXandY( ILBlock& x, ILBlock& y, ILBlock& then_branch, I
 	x.ReplaceOutEdge( y, else_branch );
 	else_branch.ReplaceInEdge( y, x );
 	then_branch.RemoveInEdge( y );
-	ilcfg_->Remove( y );
+	ilcfg_->MergeDominance( x, y );
 }
 
 void PcodeLifter::CompoundXorY( ILBlock& x, ILBlock& y, ILBlock& then_branch, ILBlock& else_branch ) const
@@ -942,7 +999,7 @@ void PcodeLifter::CompoundXorY( ILBlock& x, ILBlock& y, ILBlock& then_branch, IL
 	x.ReplaceOutEdge( y, then_branch );
 	then_branch.ReplaceInEdge( y, x );
 	else_branch.RemoveInEdge( y );
-	ilcfg_->Remove( y );
+	ilcfg_->MergeDominance( x, y );
 }
 
 ILLocalVar* PcodeLifter::Push( ILNode* value )
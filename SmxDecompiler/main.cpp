@@ -1,15 +1,137 @@
 #include <iostream>
 #include <filesystem>
+#include <chrono>
+#include <sstream>
 #include "optparse.h"
 #include "smx-file.h"
-#include "smx-disasm.h"
-#include "cfg-builder.h"
-#include "lifter.h"
-#include "il-disasm.h"
-#include "typer.h"
-#include "code-fixer.h"
-#include "structurizer.h"
+#include "decompiler.h"
+#include "batch.h"
 #include "code-writer.h"
+#include "output-buffer.h"
+#include "output-sink.h"
+#include "trace.h"
+#include "alloc-tracker.h"
+
+// Structures the function with both engines and reports how long each took and whether the code
+// they produced differs
+static void CompareStructurizers( SmxFile& smx, SmxFunction& func, double total_ms[2], size_t* num_diffs )
+{
+	const StructurizerEngine engines[2] = { StructurizerEngine::INTERVALS, StructurizerEngine::REGIONS };
+	MemorySink code[2];
+	double ms[2];
+	for( int i = 0; i < 2; i++ )
+	{
+		// Structuring changes the IL, so each engine gets a fresh copy
+		ILNodePool nodes;
+		ILNodePool::Scope use_nodes( nodes );
+		std::unique_ptr<ILControlFlowGraph> ilcfg( BuildIL( smx, func, nullptr ) );
+
+		auto start = std::chrono::steady_clock::now();
+		Structurizer structurizer( ilcfg.get(), engines[i] );
+		Statement* func_stmt = structurizer.Transform();
+		auto end = std::chrono::steady_clock::now();
+
+		ms[i] = std::chrono::duration<double, std::milli>( end - start ).count();
+		total_ms[i] += ms[i];
+
+		OutputBuffer out( code[i] );
+		CodeWriter writer( smx, func.name );
+		writer.Build( func_stmt, out );
+	}
+
+	std::cout << func.name << ": intervals " << ms[0] << " ms, regions " << ms[1] << " ms";
+	if( code[0].str() == code[1].str() )
+	{
+		std::cout << ", same\n";
+		return;
+	}
+
+	(*num_diffs)++;
+	std::cout << ", differs\n";
+
+	// Show where the outputs start to differ
+	std::istringstream a( code[0].str() ), b( code[1].str() );
+	std::string line_a, line_b;
+	for( size_t line = 1; ; line++ )
+	{
+		bool more_a = (bool)std::getline( a, line_a );
+		bool more_b = (bool)std::getline( b, line_b );
+		if( !more_a && !more_b )
+			break;
+		if( more_a != more_b || line_a != line_b )
+		{
+			std::cout << "  line " << line << "\n"
+				<< "  - " << ( more_a ? line_a : "<end>" ) << "\n"
+				<< "  + " << ( more_b ? line_b : "<end>" ) << "\n";
+			break;
+		}
+	}
+}
+
+// Stats go to stderr to keep them apart from the code
+static void PrintSchedulerStats( const SchedulerStats& stats )
+{
+	std::cerr << "Scheduler: " << stats.num_threads << " threads, " << stats.num_tasks << " tasks, "
+		<< stats.num_steals << " steals, busy " << stats.busy_ms << " ms of " << stats.wall_ms << " ms wall, "
+		<< (int)( stats.utilization() * 100.0 + 0.5 ) << "% utilization\n";
+}
+
+static void PrintPipelineStats( const PipelineStats& stats )
+{
+	std::cerr << "Pipeline: " << stats.wall_ms << " ms wall\n";
+	for( const StageStats& stage : stats.stages )
+	{
+		double utilization = stats.wall_ms > 0.0 ? stage.busy_ms / ( stats.wall_ms * stage.num_threads ) : 0.0;
+		std::cerr << "  " << stage.name << ": " << stage.num_threads << " threads, " << stage.num_items << " items, busy "
+			<< stage.busy_ms << " ms, " << (int)( utilization * 100.0 + 0.5 ) << "% utilization\n";
+	}
+}
+
+static std::unique_ptr<SmxFile> LoadFile( const std::string& path, PhaseTime& load_time )
+{
+	TraceSpan span( "phase", "load", path.c_str() );
+	Stopwatch watch;
+	watch.Start();
+	auto smx = std::make_unique<SmxFile>( path.c_str() );
+	load_time = watch.Elapsed();
+	return smx;
+}
+
+// JSON goes to files of its own so it can be kept around and compared between runs
+static bool WriteJsonFile( const char* path, const char* what, const std::function<void( OutputBuffer& )>& write )
+{
+	std::unique_ptr<OutputSink> sink = OutputSink::Open( path );
+	if( !sink )
+	{
+		std::cerr << "Could not open " << what << " file " << path << std::endl;
+		return false;
+	}
+
+	OutputBuffer out( *sink );
+	write( out );
+	out.Flush();
+	if( sink->failed() )
+	{
+		std::cerr << "Could not write " << what << " file " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Reports the stats and writes the trace the options asked for. Returns false if any of them
+// could not be written.
+static bool ReportStats( const DecompileStats& stats, OptParse& args )
+{
+	bool ok = true;
+	// --alloc-stats alone shows the allocations along with the other stats
+	if( args["stats"] || ( args["alloc-stats"] && !args["stats-json"] ) )
+		stats.WriteText( std::cerr );
+	if( args["stats-json"] && *args["stats-json"] )
+		ok &= WriteJsonFile( args["stats-json"], "stats", [&]( OutputBuffer& out ) { stats.WriteJson( out ); } );
+	if( args["trace"] && *args["trace"] )
+		ok &= WriteJsonFile( args["trace"], "trace", []( OutputBuffer& out ) { Tracer::WriteJson( out ); } );
+	return ok;
+}
 
 int main( int argc, const char* argv[] )
 {
@@ -17,78 +139,177 @@ int main( int argc, const char* argv[] )
 	args.AddArgOption( "function", 'f' )
 		.AddFlagOption( "no-globals", 'g' )
 		.AddFlagOption( "assembly", 'a' )
-		.AddFlagOption( "il", 'i' );
+		.AddFlagOption( "il", 'i' )
+		.AddArgOption( "structurizer", 's', "intervals" )
+		.AddFlagOption( "compare-structurizers", 'c' )
+		.AddArgOption( "output", 'o' )
+		.AddArgOption( "jobs", 'j', "0" )
+		.AddArgOption( "batch", 'b' )
+		.AddArgOption( "memory-limit", 'm' )
+		.AddFlagOption( "pipeline" )
+		.AddFlagOption( "stats" )
+		.AddArgOption( "stats-json" )
+		.AddArgOption( "trace" )
+		.AddFlagOption( "alloc-stats" );
 	args.Process( argc, argv );
 
 	if( args.GetArgC() < 1 )
 	{
 		std::cout << "Usage: "
 			<< argv[0]
-			<< " [--function/-f <function>] [--no-globals/-g] [--assembly/-a] [--il/-i] <filename>\n";
+			<< " [--function/-f <function>] [--no-globals/-g] [--assembly/-a] [--il/-i]"
+			<< " [--structurizer/-s <intervals|regions>] [--compare-structurizers/-c] [--output/-o <file>]"
+			<< " [--jobs/-j <count>] [--stats] [--stats-json <file>] [--alloc-stats] [--trace <file>] <filename>\n"
+			<< "       " << argv[0]
+			<< " --batch/-b <output dir> [--jobs/-j <count>] [--memory-limit/-m <MiB>] [--pipeline] [options] <files, dirs or @lists>...\n";
 		return 1;
 	}
 
-	if( !std::filesystem::exists( args.GetArg( 0 ) ) )
+	StructurizerEngine engine = StructurizerEngine::INTERVALS;
+	if( args["structurizer"] && strcmp( args["structurizer"], "regions" ) == 0 )
+		engine = StructurizerEngine::REGIONS;
+	else if( args["structurizer"] && strcmp( args["structurizer"], "intervals" ) != 0 )
 	{
-		std::cout << "Could not open file " << args.GetArg( 0 ) << std::endl;
+		std::cout << "Unknown structurizer " << args["structurizer"] << std::endl;
 		return 1;
 	}
 
-	SmxFile smx( args.GetArg( 0 ).c_str() );
-	
-	if( !args["no-globals"] )
+	DecompileOptions options;
+	options.function = args["function"];
+	options.globals = !args["no-globals"];
+	options.assembly = args["assembly"] != nullptr;
+	options.il = args["il"] != nullptr;
+	options.engine = engine;
+
+	// Without --jobs everything happens on this thread, --jobs 0 uses every hardware thread
+	size_t num_jobs = args["jobs"] ? (size_t)atoi( args["jobs"] ) : 1;
+
+	DecompileStats stats;
+	bool collect_stats = args["stats"] || args["stats-json"] || args["alloc-stats"];
+	if( args["alloc-stats"] )
+		AllocTracker::Start();
+
+	// Before any worker starts, so all of them show up
+	if( args["trace"] && *args["trace"] )
 	{
-		for( size_t i = 0; i < smx.num_globals(); i++ )
-		{
-			SmxVariable& var = smx.global( i );
-			CodeWriter writer( smx, "" );
-			std::cout << writer.BuildVarDecl( var.name, &var.type ) << ";\n";
-		}
-		std::cout << std::endl;
+		Tracer::Start();
+		Tracer::SetThreadName( "main" );
 	}
 
-	for( size_t i = 0; i < smx.num_functions(); i++ )
+	if( args["batch"] )
 	{
-		SmxFunction& func = smx.function( i );
-		if( args["function"] && strcmp(func.name, args["function"]) != 0 )
-			continue;
-
-		if( args["assembly"] )
+		if( !*args["batch"] )
 		{
-			SmxDisassembler disasm( smx );
-			std::cout << disasm.DisassembleFunction( func ).c_str() << std::endl;
+			std::cout << "No output directory given for --batch" << std::endl;
+			return 1;
 		}
 
-		CfgBuilder builder( smx );
-		ControlFlowGraph cfg = builder.Build( smx.code( func.pcode_start ) );
+		BatchOptions batch;
+		batch.output_dir = args["batch"];
+		batch.memory_limit = args["memory-limit"] ? (size_t)atoll( args["memory-limit"] ) * 1024 * 1024 : 0;
+		batch.stats = collect_stats ? &stats : nullptr;
 
-		PcodeLifter lifter( smx );
-		ILControlFlowGraph* ilcfg = lifter.Lift( cfg );
+		std::vector<std::string> inputs;
+		for( size_t i = 0; i < args.GetArgC(); i++ )
+			inputs.push_back( args.GetArg( (int)i ) );
 
-		if( args["il"] )
+		if( args["pipeline"] )
 		{
-			ILDisassembler ildisasm( smx );
-			std::cout << ildisasm.DisassembleCFG( *ilcfg );
+			PipelineStats pipeline_stats;
+			size_t num_failed = RunBatchPipeline( inputs, options, batch, num_jobs, &pipeline_stats );
+			if( args["stats"] )
+				PrintPipelineStats( pipeline_stats );
+			if( !ReportStats( stats, args ) )
+				return 1;
+			return num_failed == 0 ? 0 : 1;
 		}
 
-		Typer typer( smx );
-		typer.PopulateTypes( *ilcfg );
+		TaskScheduler scheduler( num_jobs );
+		size_t num_failed = RunBatch( inputs, options, batch, scheduler );
+		if( args["stats"] )
+			PrintSchedulerStats( scheduler.stats() );
+		if( !ReportStats( stats, args ) )
+			return 1;
+		return num_failed == 0 ? 0 : 1;
+	}
 
-		CodeFixer fixer( smx );
-		for( int i = 0; i < 3; i++ )
+	if( !std::filesystem::exists( args.GetArg( 0 ) ) )
+	{
+		std::cout << "Could not open file " << args.GetArg( 0 ) << std::endl;
+		return 1;
+	}
+
+	std::string path = args.GetArg( 0 );
+	PhaseTime load_time;
+	std::unique_ptr<SmxFile> smx_file = LoadFile( path, load_time );
+	SmxFile& smx = *smx_file;
+	if( collect_stats )
+		options.stats = &stats.AddFile( path, load_time );
+
+	if( args["compare-structurizers"] )
+	{
+		double total_ms[2] = {};
+		size_t num_compared = 0;
+		size_t num_diffs = 0;
+		for( size_t i = 0; i < smx.num_functions(); i++ )
 		{
-			typer.PopulateTypes( *ilcfg );
-			fixer.ApplyFixes( *ilcfg );
-			typer.PropagateTypes( *ilcfg );
+			SmxFunction& func = smx.function( i );
+			if( args["function"] && strcmp( func.name, args["function"] ) != 0 )
+				continue;
+
+			CompareStructurizers( smx, func, total_ms, &num_diffs );
+			num_compared++;
 		}
 
-		Structurizer structurizer( ilcfg );
-		Statement* func_stmt = structurizer.Transform();
+		std::cout << "Total: intervals " << total_ms[0] << " ms, regions " << total_ms[1] << " ms, "
+			<< num_diffs << " of " << num_compared << " functions differ\n";
+		return 0;
+	}
+	
+	// Code goes to stdout unless an output file is given
+	std::unique_ptr<OutputSink> sink;
+	if( args["output"] && *args["output"] )
+	{
+		sink = OutputSink::Open( args["output"] );
+		if( !sink )
+		{
+			std::cout << "Could not open output file " << args["output"] << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		sink = std::make_unique<FdSink>( FdSink::STDOUT );
+	}
 
-		CodeWriter writer( smx, func.name );
-		std::string code = writer.Build( func_stmt );
-		std::cout << code << std::endl;
+	// The buffer streams into the sink as it fills up, the sink is only flushed once at the end
+	OutputBuffer out( *sink );
+	{
+		// Has to end before the trace is written
+		TraceSpan file_span( "file", path.c_str() );
+		if( num_jobs == 1 )
+		{
+			DecompileFile( smx, options, out );
+		}
+		else
+		{
+			TaskScheduler scheduler( num_jobs );
+			DecompileFile( smx, options, out, &scheduler );
+			if( args["stats"] )
+				PrintSchedulerStats( scheduler.stats() );
+		}
 	}
+	if( options.stats && AllocTracker::enabled() )
+		options.stats->peak_rss = PeakRssBytes();
 
+	out.Flush();
+	if( sink->failed() )
+	{
+		std::cerr << "Could not write output" << std::endl;
+		return 1;
+	}
+
+	if( !ReportStats( stats, args ) )
+		return 1;
 	return 0;
 }
\ No newline at end of file
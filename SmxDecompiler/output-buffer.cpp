@@ -0,0 +1,94 @@
+#include "output-buffer.h"
+
+#include "output-sink.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+OutputBuffer::OutputBuffer( OutputSink& sink, size_t chunk_size )
+	:
+	chunk_size_( chunk_size ),
+	sink_( &sink )
+{}
+
+OutputBuffer::~OutputBuffer()
+{
+	// Don't lose what was written since the last drain, but leave flushing to the owner
+	if( sink_ )
+		Drain();
+}
+
+void OutputBuffer::WriteHex( uint32_t value )
+{
+	static const char hex_digits[] = "0123456789abcdef";
+
+	char digits[8];
+	char* end = digits + sizeof( digits );
+	char* p = end;
+	do
+	{
+		*--p = hex_digits[value & 0xf];
+		value >>= 4;
+	} while( value != 0 );
+	Write( p, end - p );
+}
+
+void OutputBuffer::WriteFixed( double value, int decimals )
+{
+	char digits[64];
+	int len = snprintf( digits, sizeof( digits ), "%.*f", decimals, value );
+	if( len > 0 )
+		Write( digits, std::min( (size_t)len, sizeof( digits ) - 1 ) );
+}
+
+void OutputBuffer::WriteJsonString( std::string_view str )
+{
+	static const char hex_digits[] = "0123456789abcdef";
+
+	*this << '"';
+	for( char c : str )
+	{
+		if( c == '"' || c == '\\' )
+			*this << '\\' << c;
+		else if( (unsigned char)c < 0x20 )
+			*this << "\\u00" << hex_digits[c >> 4] << hex_digits[c & 0xf];
+		else
+			*this << c;
+	}
+	*this << '"';
+}
+
+void OutputBuffer::Drain()
+{
+	assert( sink_ );
+	if( size_ )
+		sink_->Write( data_.get(), size_ );
+	size_ = 0;
+}
+
+void OutputBuffer::Flush()
+{
+	Drain();
+	sink_->Flush();
+}
+
+void OutputBuffer::MakeRoom( size_t size )
+{
+	// Buffers with a sink stay at their size when they can
+	if( sink_ && size_ )
+	{
+		Drain();
+		if( size <= capacity_ )
+			return;
+	}
+
+	size_t capacity = capacity_ ? capacity_ * 2 : chunk_size_;
+	while( capacity < size_ + size )
+		capacity *= 2;
+
+	std::unique_ptr<char[]> data( new char[capacity] );
+	if( size_ )
+		memcpy( data.get(), data_.get(), size_ );
+	data_ = std::move( data );
+	capacity_ = capacity;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class OutputSink;
+
+// Growable byte buffer that text output is built in. Much cheaper than the iostreams for the
+// amount of small writes the decompiler does: appends are a bounds check and a memcpy, and
+// integers are formatted by hand.
+//
+// A buffer attached to a sink doesn't grow, it passes its contents on to the sink whenever it
+// fills up. Code is then streamed out while it is being written, and the sink is only flushed
+// when Flush() is called.
+class OutputBuffer
+{
+public:
+	static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+	OutputBuffer() = default;
+	explicit OutputBuffer( OutputSink& sink, size_t chunk_size = DEFAULT_CHUNK_SIZE );
+	~OutputBuffer();
+	OutputBuffer( const OutputBuffer& ) = delete;
+	OutputBuffer& operator=( const OutputBuffer& ) = delete;
+
+	OutputBuffer& operator<<( char c )
+	{
+		Reserve( 1 );
+		data_[size_++] = c;
+		return *this;
+	}
+	OutputBuffer& operator<<( std::string_view str ) { Write( str.data(), str.size() ); return *this; }
+	OutputBuffer& operator<<( const char* str ) { Write( str, strlen( str ) ); return *this; }
+	OutputBuffer& operator<<( const std::string& str ) { Write( str.data(), str.size() ); return *this; }
+
+	OutputBuffer& operator<<( int value ) { WriteSigned( value ); return *this; }
+	OutputBuffer& operator<<( long value ) { WriteSigned( value ); return *this; }
+	OutputBuffer& operator<<( long long value ) { WriteSigned( value ); return *this; }
+	OutputBuffer& operator<<( unsigned int value ) { WriteUnsigned( value ); return *this; }
+	OutputBuffer& operator<<( unsigned long value ) { WriteUnsigned( value ); return *this; }
+	OutputBuffer& operator<<( unsigned long long value ) { WriteUnsigned( value ); return *this; }
+
+	void Write( const char* data, size_t size )
+	{
+		Reserve( size );
+		memcpy( data_.get() + size_, data, size );
+		size_ += size;
+	}
+
+	// Lowercase hex without a prefix, negative cells are written as their two's complement
+	void WriteHex( uint32_t value );
+	// Fixed point with the given number of decimals
+	void WriteFixed( double value, int decimals );
+	// In quotes, escaped as a JSON string
+	void WriteJsonString( std::string_view str );
+
+	// Hands the buffered output to the sink without flushing the sink itself
+	void Drain();
+	// Drains the buffer and flushes the sink
+	void Flush();
+
+	const char* data() const { return data_.get(); }
+	size_t size() const { return size_; }
+	std::string str() const { return size_ ? std::string( data_.get(), size_ ) : std::string(); }
+	void clear() { size_ = 0; }
+private:
+	void Reserve( size_t size )
+	{
+		if( size_ + size > capacity_ )
+			MakeRoom( size );
+	}
+	void MakeRoom( size_t size );
+
+	void WriteSigned( long long value )
+	{
+		if( value < 0 )
+		{
+			*this << '-';
+			WriteUnsigned( 0 - (unsigned long long)value );
+		}
+		else
+		{
+			WriteUnsigned( (unsigned long long)value );
+		}
+	}
+	void WriteUnsigned( unsigned long long value )
+	{
+		char digits[20];
+		char* end = digits + sizeof( digits );
+		char* p = end;
+		do
+		{
+			*--p = '0' + (char)( value % 10 );
+			value /= 10;
+		} while( value != 0 );
+		Write( p, end - p );
+	}
+private:
+	std::unique_ptr<char[]> data_;
+	size_t size_ = 0;
+	size_t capacity_ = 0;
+	size_t chunk_size_ = 4096;
+	OutputSink* sink_ = nullptr;
+};
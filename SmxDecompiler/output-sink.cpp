@@ -0,0 +1,91 @@
+#include "output-sink.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "third_party/zlib/zlib.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+std::unique_ptr<OutputSink> OutputSink::Open( const char* path )
+{
+	size_t len = strlen( path );
+	if( len > 3 && strcmp( path + len - 3, ".gz" ) == 0 )
+	{
+		gzFile file = gzopen( path, "wb" );
+		if( !file )
+			return nullptr;
+		return std::make_unique<GzipSink>( file );
+	}
+
+	FILE* file = fopen( path, "wb" );
+	if( !file )
+		return nullptr;
+	return std::make_unique<FileSink>( file );
+}
+
+void FdSink::Write( const char* data, size_t size )
+{
+	while( size > 0 && !failed_ )
+	{
+		auto written = write( fd_, data, (unsigned int)std::min<size_t>( size, INT_MAX ) );
+		if( written <= 0 )
+		{
+			failed_ = true;
+			break;
+		}
+
+		data += written;
+		size -= written;
+	}
+}
+
+FileSink::~FileSink()
+{
+	fclose( file_ );
+}
+
+void FileSink::Write( const char* data, size_t size )
+{
+	if( !failed_ && fwrite( data, 1, size, file_ ) != size )
+		failed_ = true;
+}
+
+void FileSink::Flush()
+{
+	if( !failed_ && fflush( file_ ) != 0 )
+		failed_ = true;
+}
+
+GzipSink::~GzipSink()
+{
+	gzclose( (gzFile)file_ );
+}
+
+void GzipSink::Write( const char* data, size_t size )
+{
+	while( size > 0 && !failed_ )
+	{
+		unsigned int chunk = (unsigned int)std::min<size_t>( size, INT_MAX );
+		if( gzwrite( (gzFile)file_, data, chunk ) != (int)chunk )
+		{
+			failed_ = true;
+			break;
+		}
+
+		data += chunk;
+		size -= chunk;
+	}
+}
+
+void GzipSink::Flush()
+{
+	// A full flush would reset the compressor, only push out what is pending
+	if( !failed_ && gzflush( (gzFile)file_, Z_SYNC_FLUSH ) != Z_OK )
+		failed_ = true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+// Destination for the text an OutputBuffer produces. Sinks only see data in large chunks, and are
+// only flushed when someone explicitly asks for it.
+class OutputSink
+{
+public:
+	virtual ~OutputSink() = default;
+
+	virtual void Write( const char* data, size_t size ) = 0;
+	virtual void Flush() {}
+
+	// Whether any write so far failed. Failures are sticky, later writes are dropped.
+	bool failed() const { return failed_; }
+
+	// Opens a sink writing to the file at path, gzip compressed if the name ends in ".gz".
+	// Returns nullptr if the file can't be opened.
+	static std::unique_ptr<OutputSink> Open( const char* path );
+protected:
+	bool failed_ = false;
+};
+
+// Writes straight to a file descriptor that is owned by someone else, such as stdout
+class FdSink : public OutputSink
+{
+public:
+	static constexpr int STDOUT = 1;
+
+	explicit FdSink( int fd ) : fd_( fd ) {}
+
+	virtual void Write( const char* data, size_t size ) override;
+private:
+	int fd_;
+};
+
+class FileSink : public OutputSink
+{
+public:
+	// Takes ownership of the file
+	explicit FileSink( FILE* file ) : file_( file ) {}
+	virtual ~FileSink() override;
+
+	virtual void Write( const char* data, size_t size ) override;
+	virtual void Flush() override;
+private:
+	FILE* file_;
+};
+
+class GzipSink : public OutputSink
+{
+public:
+	// Takes ownership of the zlib gzFile handle
+	explicit GzipSink( void* file ) : file_( file ) {}
+	virtual ~GzipSink() override;
+
+	virtual void Write( const char* data, size_t size ) override;
+	virtual void Flush() override;
+private:
+	void* file_;
+};
+
+class MemorySink : public OutputSink
+{
+public:
+	virtual void Write( const char* data, size_t size ) override { data_.append( data, size ); }
+
+	const std::string& str() const { return data_; }
+	void clear() { data_.clear(); }
+private:
+	std::string data_;
+};
\ No newline at end of file
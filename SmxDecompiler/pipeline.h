@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "bounded-queue.h"
+#include "trace.h"
+
+struct StageStats
+{
+	const char* name = "";
+	size_t num_threads = 0;
+	size_t num_items = 0;
+	// Time the threads of the stage spent working on items, summed over all of them. Waiting for
+	// items or for room downstream doesn't count.
+	double busy_ms = 0.0;
+};
+
+struct PipelineStats
+{
+	std::vector<StageStats> stages;
+	double wall_ms = 0.0;
+};
+
+// One stage of a pipeline. Its threads take items from in, run fn on them and pass them on to out.
+// Once in is closed and drained and every thread is done, out is closed in turn, so closing the
+// first queue shuts down the whole pipeline in order. The last stage has no out.
+template <typename T>
+class PipelineStage
+{
+public:
+	PipelineStage( const char* name, size_t num_threads, BoundedQueue<T>& in, BoundedQueue<T>* out,
+		std::function<void( T& )> fn )
+		:
+		name_( name ),
+		in_( in ),
+		out_( out ),
+		fn_( std::move( fn ) ),
+		num_running_( num_threads )
+	{
+		threads_.reserve( num_threads );
+		for( size_t i = 0; i < num_threads; i++ )
+			threads_.emplace_back( &PipelineStage::ThreadMain, this );
+	}
+	PipelineStage( const PipelineStage& ) = delete;
+	PipelineStage& operator=( const PipelineStage& ) = delete;
+	~PipelineStage() { Join(); }
+
+	void Join()
+	{
+		for( std::thread& thread : threads_ )
+		{
+			if( thread.joinable() )
+				thread.join();
+		}
+	}
+
+	StageStats stats() const
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		StageStats stats;
+		stats.name = name_;
+		stats.num_threads = threads_.size();
+		stats.num_items = num_items_;
+		stats.busy_ms = busy_ms_;
+		return stats;
+	}
+private:
+	void ThreadMain()
+	{
+		Tracer::SetThreadName( name_ );
+
+		size_t num_items = 0;
+		double busy_ms = 0.0;
+
+		T item;
+		while( in_.Pop( item ) )
+		{
+			auto start = std::chrono::steady_clock::now();
+			fn_( item );
+			busy_ms += std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+			num_items++;
+
+			if( out_ )
+				out_->Push( std::move( item ) );
+		}
+
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			num_items_ += num_items;
+			busy_ms_ += busy_ms;
+		}
+
+		if( --num_running_ == 0 && out_ )
+			out_->Close();
+	}
+private:
+	const char* name_;
+	BoundedQueue<T>& in_;
+	BoundedQueue<T>* out_;
+	std::function<void( T& )> fn_;
+	std::vector<std::thread> threads_;
+	std::atomic<size_t> num_running_;
+
+	mutable std::mutex mutex_;
+	size_t num_items_ = 0;
+	double busy_ms_ = 0.0;
+};
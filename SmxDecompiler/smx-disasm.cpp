@@ -1,7 +1,5 @@
 #include "smx-disasm.h"
 
-#include <sstream>
-
 SmxDisassembler::SmxDisassembler( const SmxFile& smx )
 	:
 	smx_( &smx )
@@ -9,19 +7,41 @@ SmxDisassembler::SmxDisassembler( const SmxFile& smx )
 
 std::string SmxDisassembler::DisassembleInstr( const cell_t* instr )
 {
+	OutputBuffer out;
+	DisassembleInstr( instr, out );
+	return out.str();
+}
+
+std::string SmxDisassembler::DisassembleFunction( const SmxFunction& func )
+{
+	OutputBuffer out;
+	DisassembleFunction( func, out );
+	return out.str();
+}
+
+std::string SmxDisassembler::DisassembleBlock( const BasicBlock& bb )
+{
+	OutputBuffer out;
+	DisassembleBlock( bb, out );
+	return out.str();
+}
+
+void SmxDisassembler::DisassembleInstr( const cell_t* instr, OutputBuffer& out )
+{
+	// Everything is printed in hex, addresses as well as operands
 	const auto& info = SmxInstrInfo::Get( instr[0] );
-	std::ostringstream ss;
 	cell_t addr = (cell_t)( (intptr_t)instr - (intptr_t)smx_->code() );
-	ss << std::hex << addr << '\t' << info.mnem;
+	out.WriteHex( addr );
+	out << '\t' << info.mnem;
 	if( info.num_params > 0 )
 	{
-		ss << " ";
+		out << ' ';
 		for( int param = 1; param <= info.num_params; param++ )
 		{
-			ss << instr[param];
+			out.WriteHex( instr[param] );
 			if( param != info.num_params )
 			{
-				ss << ", ";
+				out << ", ";
 			}
 		}
 	}
@@ -32,44 +52,38 @@ std::string SmxDisassembler::DisassembleInstr( const cell_t* instr )
 		instr += 3;
 		for( cell_t i = 0; i < num_cases; i++ )
 		{
-			ss << '\n';
+			out << '\n';
 
 			cell_t addr = (cell_t)((intptr_t)instr - (intptr_t)smx_->code());
-			ss << std::hex << addr << '\t';
-			ss << "case " << instr[0] << ", " << instr[1];
+			out.WriteHex( addr );
+			out << "\tcase ";
+			out.WriteHex( instr[0] );
+			out << ", ";
+			out.WriteHex( instr[1] );
 			instr += 2;
 		}
 	}
+}
 
-	return ss.str();
+void SmxDisassembler::DisassembleFunction( const SmxFunction& func, OutputBuffer& out )
+{
+	DisassembleRange( smx_->code( func.pcode_start ), smx_->code( func.pcode_end ), out );
 }
 
-std::string SmxDisassembler::DisassembleFunction( const SmxFunction& func )
+void SmxDisassembler::DisassembleBlock( const BasicBlock& bb, OutputBuffer& out )
 {
-	std::ostringstream ss;
-	const cell_t* instr = smx_->code( func.pcode_start );
-	while( instr < smx_->code( func.pcode_end ) )
-	{
-		const auto& info = SmxInstrInfo::Get( instr[0] );
-		ss << DisassembleInstr( instr ) << "\n";
-		if( instr[0] == SMX_OP_CASETBL )
-			instr += instr[1] * 2;
-		instr += 1 + info.num_params;
-	}
-	return ss.str();
+	DisassembleRange( bb.start(), bb.end(), out );
 }
 
-std::string SmxDisassembler::DisassembleBlock( const BasicBlock& bb )
+void SmxDisassembler::DisassembleRange( const cell_t* instr, const cell_t* end, OutputBuffer& out )
 {
-	std::ostringstream ss;
-	const cell_t* instr = bb.start();
-	while( instr < bb.end() )
+	while( instr < end )
 	{
 		const auto& info = SmxInstrInfo::Get( instr[0] );
-		ss << DisassembleInstr( instr ) << "\n";
+		DisassembleInstr( instr, out );
+		out << '\n';
 		if( instr[0] == SMX_OP_CASETBL )
 			instr += instr[1] * 2;
 		instr += 1 + info.num_params;
 	}
-	return ss.str();
 }
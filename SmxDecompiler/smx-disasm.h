@@ -3,6 +3,7 @@
 #include "smx-file.h"
 #include "smx-opcodes.h"
 #include "cfg.h"
+#include "output-buffer.h"
 #include <string>
 
 class SmxDisassembler
@@ -13,6 +14,12 @@ public:
 	std::string DisassembleInstr( const cell_t* instr );
 	std::string DisassembleFunction( const SmxFunction& func );
 	std::string DisassembleBlock( const BasicBlock& bb );
+
+	void DisassembleInstr( const cell_t* instr, OutputBuffer& out );
+	void DisassembleFunction( const SmxFunction& func, OutputBuffer& out );
+	void DisassembleBlock( const BasicBlock& bb, OutputBuffer& out );
+private:
+	void DisassembleRange( const cell_t* instr, const cell_t* end, OutputBuffer& out );
 private:
 	const SmxFile* smx_;
 };
\ No newline at end of file
@@ -2,9 +2,15 @@
 
 #include <fstream>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include "third_party/zlib/zlib.h"
 
+#ifndef _WIN32
+#include <strings.h>
+#define stricmp strcasecmp
+#endif
+
 struct SmxConsts {
     static const uint32_t FILE_MAGIC = 0x53504646;
 
@@ -423,6 +429,29 @@ void SmxFile::ReadPubvars( const char* name, size_t offset, size_t size )
     }
 }
 
+static const struct
+{
+    const char* name;
+    SmxNative::SmxNativeIntrinsic intrinsic;
+} kNativeIntrinsics[] =
+{
+    { "FloatMul",      SmxNative::FLOAT_MUL },
+    { "__FLOAT_MUL__", SmxNative::FLOAT_MUL },
+    { "FloatDiv",      SmxNative::FLOAT_DIV },
+    { "__FLOAT_DIV__", SmxNative::FLOAT_DIV },
+    { "FloatAdd",      SmxNative::FLOAT_ADD },
+    { "__FLOAT_ADD__", SmxNative::FLOAT_ADD },
+    { "FloatSub",      SmxNative::FLOAT_SUB },
+    { "__FLOAT_SUB__", SmxNative::FLOAT_SUB },
+    { "__FLOAT_NOT__", SmxNative::FLOAT_NOT },
+    { "__FLOAT_GT__",  SmxNative::FLOAT_GT },
+    { "__FLOAT_GE__",  SmxNative::FLOAT_GE },
+    { "__FLOAT_LT__",  SmxNative::FLOAT_LT },
+    { "__FLOAT_LE__",  SmxNative::FLOAT_LE },
+    { "__FLOAT_NE__",  SmxNative::FLOAT_NE },
+    { "__FLOAT_EQ__",  SmxNative::FLOAT_EQ },
+};
+
 void SmxFile::ReadNatives( const char* name, size_t offset, size_t size )
 {
     auto* rows = (sp_file_natives_t*)(image_.get() + offset);
@@ -432,6 +461,16 @@ void SmxFile::ReadNatives( const char* name, size_t offset, size_t size )
         SmxNative native;
         native.name = names_ + rows[i].name;
 
+        // Resolve intrinsics here once so the passes don't have to compare names
+        for( const auto& intrinsic : kNativeIntrinsics )
+        {
+            if( strcmp( native.name, intrinsic.name ) == 0 )
+            {
+                native.intrinsic = intrinsic.intrinsic;
+                break;
+            }
+        }
+
         natives_.push_back( native );
     }
 }
@@ -592,7 +631,17 @@ void SmxFile::ReadRttiEnumStructs( const char* name, size_t offset, size_t size
         }
         es.fields = &es_fields_[row->first_field];
         es.size = row->size;
-        enum_structs_.push_back( es );
+
+        // Index the fields so accesses can be matched to them in constant time
+        for( size_t field = 0; field < es.num_fields; field++ )
+        {
+            SmxESField* esf = &es.fields[field];
+            if( esf->offset >= es.fields_by_offset.size() )
+                es.fields_by_offset.resize( esf->offset + 1 );
+            if( !es.fields_by_offset[esf->offset] )
+                es.fields_by_offset[esf->offset] = esf;
+        }
+        enum_structs_.push_back( std::move( es ) );
     }
 }
 
@@ -937,3 +986,48 @@ uint32_t SmxFile::DecodeUint32( unsigned char** data )
     }
     return value;
 }
+
+const SmxVariableType* SmxFile::PrimitiveType( SmxVariableType::SmxVariableTag tag )
+{
+    SmxVariableType type;
+    type.tag = tag;
+    return CanonicalType( type );
+}
+
+const SmxVariableType* SmxFile::ArrayType( const SmxVariableType& elem_type )
+{
+    // Adds one more dimension of unknown size
+    std::vector<int> dims( elem_type.dims, elem_type.dims + elem_type.dimcount );
+    dims.push_back( 0 );
+
+    SmxVariableType type = elem_type;
+    type.dims = dims.data();
+    type.dimcount = (int)dims.size();
+    return CanonicalType( type );
+}
+
+const SmxVariableType* SmxFile::CanonicalType( const SmxVariableType& type )
+{
+    // Only the composite tags use the union
+    const void* composite = nullptr;
+    if( type.tag >= SmxVariableType::ENUM )
+        composite = type.enum_struct;
+
+    std::vector<int> dims( type.dims, type.dims + type.dimcount );
+    SmxTypeKey key( type.tag, type.flags, composite, dims );
+
+    std::lock_guard<std::mutex> lock( canonical_types_mutex_ );
+    auto it = canonical_types_.find( key );
+    if( it != canonical_types_.end() )
+        return &it->second->type;
+
+    auto canonical = std::make_unique<SmxCanonicalType>();
+    canonical->dims = std::move( dims );
+    canonical->type = type;
+    canonical->type.dims = canonical->dims.empty() ? nullptr : canonical->dims.data();
+    canonical->type.enum_struct = (SmxEnumStruct*)composite;
+
+    const SmxVariableType* result = &canonical->type;
+    canonical_types_.emplace( std::move( key ), std::move( canonical ) );
+    return result;
+}
@@ -2,6 +2,9 @@
 
 #include <vector>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 using cell_t = int32_t;
 
@@ -108,8 +111,26 @@ struct SmxFunction
 
 struct SmxNative
 {
+	// Natives the compiler emits for operations that have a direct equivalent in code
+	enum SmxNativeIntrinsic
+	{
+		NONE = 0,
+		FLOAT_MUL,
+		FLOAT_DIV,
+		FLOAT_ADD,
+		FLOAT_SUB,
+		FLOAT_NOT,
+		FLOAT_GT,
+		FLOAT_GE,
+		FLOAT_LT,
+		FLOAT_LE,
+		FLOAT_NE,
+		FLOAT_EQ
+	};
+
 	const char* name;
 	SmxFunctionSignature signature;
+	SmxNativeIntrinsic intrinsic = NONE;
 };
 
 struct SmxEnum
@@ -144,14 +165,12 @@ struct SmxEnumStruct
 	SmxESField* fields;
 	uint32_t size;
 
-	SmxESField* FindFieldAtOffset( size_t offset )
+	// Field at each cell offset, built when the enum struct is read
+	std::vector<SmxESField*> fields_by_offset;
+
+	SmxESField* FindFieldAtOffset( size_t offset ) const
 	{
-		for( size_t i = 0; i < num_fields; i++ )
-		{
-			if( fields[i].offset == offset )
-				return &fields[i];
-		}
-		return nullptr;
+		return offset < fields_by_offset.size() ? fields_by_offset[offset] : nullptr;
 	}
 };
 
@@ -174,6 +193,8 @@ struct SmxClassDef
 	SmxField* fields;
 };
 
+// Nothing in the file changes after it is loaded, apart from the canonical type registry which
+// takes a lock. Functions can therefore be decompiled on several threads at once.
 class SmxFile
 {
 public:
@@ -201,6 +222,11 @@ public:
 	size_t num_globals() const { return globals_.size(); }
 	SmxVariable& global( size_t index ) { return globals_[index]; }
 
+	// Canonical types for everything that builds types on the fly. They live as long as the file,
+	// so equal types built this way are the same pointer
+	const SmxVariableType* PrimitiveType( SmxVariableType::SmxVariableTag tag );
+	const SmxVariableType* ArrayType( const SmxVariableType& elem_type );
+
 	cell_t* code( size_t addr = 0 ) const { return (cell_t*)((uintptr_t)code_ + addr); }
 	size_t code_size() const { return code_size_; }
 	cell_t* data( size_t addr = 0 ) const { return (cell_t*)((uintptr_t)data_ + addr); }
@@ -234,6 +260,8 @@ private:
 	SmxFunctionSignature DecodeFunctionSignature( uint32_t signature );
 	SmxFunctionSignature DecodeFunctionSignature( unsigned char** data );
 	uint32_t DecodeUint32( unsigned char** data );
+
+	const SmxVariableType* CanonicalType( const SmxVariableType& type );
 private:
 	std::unique_ptr<char[]> image_;
 	char* stringtab_ = nullptr;
@@ -256,4 +284,13 @@ private:
 	std::vector<SmxField> fields_;
 	std::vector<SmxVariable> globals_;
 	std::vector<SmxVariable> locals_;
+
+	using SmxTypeKey = std::tuple<int, int, const void*, std::vector<int>>;
+	struct SmxCanonicalType
+	{
+		SmxVariableType type;
+		std::vector<int> dims;
+	};
+	std::map<SmxTypeKey, std::unique_ptr<SmxCanonicalType>> canonical_types_;
+	std::mutex canonical_types_mutex_;
 };
\ No newline at end of file
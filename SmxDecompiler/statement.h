@@ -1,6 +1,9 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
 #include "il.h"
 
 enum class StatementType
@@ -65,33 +68,28 @@ private:
 class BasicStatement : public Statement
 {
 public:
-	BasicStatement( std::vector<ILNode*> nodes, Statement* next ) :
-		Statement( StatementType::BASIC, next ),
-		nodes_( std::move( nodes ) )
-	{}
+	// Refers to the nodes of the block instead of copying them, the block has to outlive the statement
 	BasicStatement( ILBlock* block, Statement* next ) :
-		Statement( StatementType::BASIC, next )
+		Statement( StatementType::BASIC, next ),
+		block_( block ),
+		num_nodes_( block->num_nodes() )
 	{
-		size_t end = block->num_nodes();
-
 		// If this is a jump then we don't want to include it, but if it is a fallthrough then keep it
 		if( block->num_out_edges() > 1 ||
 			dynamic_cast<ILJump*>(block->Last()) ||
 			dynamic_cast<ILSwitch*>(block->Last()))
 		{
-			end -= 1;
+			num_nodes_ -= 1;
 		}
-
-		for( size_t i = 0; i < end; i++ )
-			nodes_.push_back( block->node( i ) );
 	}
 
-	size_t num_nodes() const { return nodes_.size(); }
-	ILNode* node( size_t index ) { return nodes_[index]; }
+	size_t num_nodes() const { return num_nodes_; }
+	ILNode* node( size_t index ) { return block_->node( index ); }
 
 	virtual void Accept( StatementVisitor* visitor ) override { visitor->VisitBasicStatement( this ); }
 private:
-	std::vector<ILNode*> nodes_;
+	ILBlock* block_;
+	size_t num_nodes_;
 };
 
 class IfStatement : public Statement
@@ -230,4 +228,45 @@ public:
 	virtual void Accept( StatementVisitor* visitor ) override { visitor->VisitGotoStatement( this ); }
 private:
 	Statement* target_;
-};
\ No newline at end of file
+};
+
+// Owns the statements of a function. They are allocated back to back in large chunks instead of
+// one by one, and are all freed together with the arena
+class StatementArena
+{
+public:
+	StatementArena() = default;
+	StatementArena( const StatementArena& ) = delete;
+	StatementArena& operator=( const StatementArena& ) = delete;
+	~StatementArena()
+	{
+		for( Statement* stmt : statements_ )
+			stmt->~Statement();
+	}
+
+	template <typename T, typename... Args>
+	T* New( Args&&... args )
+	{
+		static_assert( alignof( T ) <= alignof( std::max_align_t ), "Statement is overaligned" );
+
+		size_t size = ( sizeof( T ) + alignof( std::max_align_t ) - 1 ) & ~( alignof( std::max_align_t ) - 1 );
+		if( chunks_.empty() || used_ + size > CHUNK_SIZE )
+		{
+			chunks_.emplace_back( new std::max_align_t[CHUNK_SIZE / sizeof( std::max_align_t )] );
+			used_ = 0;
+		}
+
+		void* mem = reinterpret_cast<char*>( chunks_.back().get() ) + used_;
+		used_ += size;
+
+		T* stmt = new( mem ) T( std::forward<Args>( args )... );
+		statements_.push_back( stmt );
+		return stmt;
+	}
+private:
+	static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+	std::vector<std::unique_ptr<std::max_align_t[]>> chunks_;
+	size_t used_ = 0;
+	std::vector<Statement*> statements_;
+};
@@ -0,0 +1,389 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include "output-buffer.h"
+#include "alloc-tracker.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+thread_local FunctionStats* FunctionStats::current_ = nullptr;
+thread_local PhaseTimer* PhaseTimer::innermost_ = nullptr;
+
+static double ThreadCpuMs()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetThreadTimes( GetCurrentThread(), &creation, &exit, &kernel, &user );
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	// 100 ns units
+	return ( k.QuadPart + u.QuadPart ) / 10000.0;
+#else
+	timespec ts;
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+const char* PhaseName( Phase phase )
+{
+	switch( phase )
+	{
+	case Phase::CFG: return "cfg";
+	case Phase::LIFT: return "lift";
+	case Phase::FIXUP: return "fixup";
+	case Phase::DERIVED: return "derived";
+	case Phase::STRUCTURE: return "structure";
+	case Phase::WRITE: return "write";
+	default: return "?";
+	}
+}
+
+void Stopwatch::Start()
+{
+	wall_start_ = std::chrono::steady_clock::now();
+	cpu_start_ms_ = ThreadCpuMs();
+}
+
+PhaseTime Stopwatch::Elapsed() const
+{
+	PhaseTime time;
+	time.wall_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - wall_start_ ).count();
+	time.cpu_ms = ThreadCpuMs() - cpu_start_ms_;
+	return time;
+}
+
+PhaseTime FunctionStats::total() const
+{
+	PhaseTime total;
+	for( const PhaseTime& phase : phases )
+		total += phase;
+	return total;
+}
+
+FunctionStats::Scope::Scope( FunctionStats* stats )
+	:
+	prev_( current_ )
+{
+	current_ = stats;
+}
+
+FunctionStats::Scope::~Scope()
+{
+	current_ = prev_;
+}
+
+PhaseTimer::PhaseTimer( Phase phase )
+	:
+	stats_( FunctionStats::current() ),
+	phase_( phase ),
+	span_( "phase", PhaseName( phase ) )
+{
+	if( !stats_ )
+		return;
+
+	outer_ = innermost_;
+	if( outer_ )
+		outer_->Stop();
+	innermost_ = this;
+	watch_.Start();
+}
+
+PhaseTimer::~PhaseTimer()
+{
+	if( !stats_ )
+		return;
+
+	Stop();
+	innermost_ = outer_;
+	if( outer_ )
+		outer_->watch_.Start();
+}
+
+void PhaseTimer::Stop()
+{
+	stats_->phases[(size_t)phase_] += watch_.Elapsed();
+}
+
+FileStats& DecompileStats::AddFile( const std::string& path, const PhaseTime& load )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	FileStats& file = files_.emplace_back();
+	file.path = path;
+	file.load = load;
+	return file;
+}
+
+namespace
+{
+	struct Totals
+	{
+		size_t num_functions = 0;
+		PhaseTime load;
+		PhaseTime phases[NUM_PHASES];
+		FunctionStats counts;
+		size_t max_derived_levels = 0;
+		size_t max_fixup_rounds = 0;
+		size_t peak_rss = 0;
+
+		void Add( const FileStats& file )
+		{
+			load += file.load;
+			peak_rss = std::max( peak_rss, file.peak_rss );
+			for( const FunctionStats& func : file.functions )
+			{
+				num_functions++;
+				for( size_t i = 0; i < NUM_PHASES; i++ )
+					phases[i] += func.phases[i];
+				counts.num_blocks += func.num_blocks;
+				counts.num_il_nodes += func.num_il_nodes;
+				counts.num_phis += func.num_phis;
+				counts.num_temps += func.num_temps;
+				counts.num_gotos += func.num_gotos;
+				counts.num_derived_levels += func.num_derived_levels;
+				counts.num_fixup_rounds += func.num_fixup_rounds;
+				max_derived_levels = std::max( max_derived_levels, func.num_derived_levels );
+				max_fixup_rounds = std::max( max_fixup_rounds, func.num_fixup_rounds );
+
+				for( size_t i = 0; i < NUM_PHASES; i++ )
+					counts.allocs[i] += func.allocs[i];
+				counts.total_allocs += func.total_allocs;
+				for( const auto& [kind, count] : func.node_allocs )
+					counts.node_allocs[kind] += count;
+			}
+		}
+	};
+}
+
+static double KiB( size_t bytes )
+{
+	return bytes / 1024.0;
+}
+
+static void WriteAllocsText( std::ostream& out, const FunctionStats& stats )
+{
+	out << stats.total_allocs.count << " allocations, " << KiB( stats.total_allocs.bytes ) << " KiB (";
+	for( size_t i = 0; i < NUM_PHASES; i++ )
+	{
+		out << ( i ? ", " : "" ) << PhaseName( (Phase)i ) << " " << stats.allocs[i].count << " / "
+			<< KiB( stats.allocs[i].bytes ) << " KiB";
+	}
+	out << ")";
+}
+
+static void WriteCountsText( std::ostream& out, const FunctionStats& stats )
+{
+	out << stats.num_blocks << " blocks, " << stats.num_il_nodes << " IL nodes, " << stats.num_phis << " phis, "
+		<< stats.num_temps << " temps, " << stats.num_gotos << " gotos, " << stats.num_derived_levels << " derived levels, "
+		<< stats.num_fixup_rounds << " fixup rounds";
+}
+
+void DecompileStats::WriteText( std::ostream& out ) const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision( 3 );
+
+	const bool allocs = AllocTracker::enabled();
+	Totals totals;
+	for( const FileStats& file : files_ )
+	{
+		totals.Add( file );
+
+		out << file.path << ": load " << file.load.wall_ms << " ms";
+		if( allocs )
+			out << ", peak RSS " << KiB( file.peak_rss ) / 1024.0 << " MiB";
+		out << "\n";
+		for( const FunctionStats& func : file.functions )
+		{
+			PhaseTime total = func.total();
+			out << "  " << func.name << ": " << total.wall_ms << " ms wall, " << total.cpu_ms << " ms cpu (";
+			for( size_t i = 0; i < NUM_PHASES; i++ )
+				out << ( i ? ", " : "" ) << PhaseName( (Phase)i ) << " " << func.phases[i].wall_ms;
+			out << "), ";
+			WriteCountsText( out, func );
+			out << "\n";
+			if( allocs )
+			{
+				out << "    ";
+				WriteAllocsText( out, func );
+				out << "\n";
+			}
+		}
+	}
+
+	PhaseTime total = totals.load;
+	for( const PhaseTime& phase : totals.phases )
+		total += phase;
+
+	out << "Total over " << files_.size() << " files, " << totals.num_functions << " functions:\n";
+	out << "  phase         wall ms      cpu ms  share\n";
+	auto row = [&]( const char* name, const PhaseTime& time ) {
+		double share = total.wall_ms > 0.0 ? time.wall_ms * 100.0 / total.wall_ms : 0.0;
+		out << "  " << std::left << std::setw( 10 ) << name << std::right
+			<< std::setw( 12 ) << time.wall_ms << std::setw( 12 ) << time.cpu_ms
+			<< std::setw( 6 ) << (int)( share + 0.5 ) << "%\n";
+	};
+	row( "load", totals.load );
+	for( size_t i = 0; i < NUM_PHASES; i++ )
+		row( PhaseName( (Phase)i ), totals.phases[i] );
+	row( "total", total );
+
+	out << "  ";
+	WriteCountsText( out, totals.counts );
+	out << "\n  at most " << totals.max_derived_levels << " derived levels and " << totals.max_fixup_rounds
+		<< " fixup rounds in one function\n";
+
+	if( allocs )
+	{
+		out << "  phase       allocations         KiB\n";
+		for( size_t i = 0; i < NUM_PHASES; i++ )
+		{
+			out << "  " << std::left << std::setw( 10 ) << PhaseName( (Phase)i ) << std::right
+				<< std::setw( 13 ) << totals.counts.allocs[i].count << std::setw( 12 ) << KiB( totals.counts.allocs[i].bytes ) << "\n";
+		}
+		out << "  " << std::left << std::setw( 10 ) << "total" << std::right
+			<< std::setw( 13 ) << totals.counts.total_allocs.count << std::setw( 12 ) << KiB( totals.counts.total_allocs.bytes ) << "\n";
+
+		// Biggest kinds of nodes first
+		std::vector<std::pair<std::string, AllocCount>> kinds( totals.counts.node_allocs.begin(), totals.counts.node_allocs.end() );
+		std::stable_sort( kinds.begin(), kinds.end(),
+			[]( const auto& a, const auto& b ) { return a.second.bytes > b.second.bytes; } );
+		out << "  node kind           nodes         KiB\n";
+		for( const auto& [kind, count] : kinds )
+		{
+			out << "  " << std::left << std::setw( 18 ) << kind << std::right
+				<< std::setw( 7 ) << count.count << std::setw( 12 ) << KiB( count.bytes ) << "\n";
+		}
+		out << "  peak RSS " << KiB( totals.peak_rss ) / 1024.0 << " MiB\n";
+	}
+
+	out.flags( flags );
+	out.precision( precision );
+}
+
+static void WriteJsonTime( OutputBuffer& out, const PhaseTime& time )
+{
+	out << "{\"wall_ms\":";
+	out.WriteFixed( time.wall_ms, 3 );
+	out << ",\"cpu_ms\":";
+	out.WriteFixed( time.cpu_ms, 3 );
+	out << '}';
+}
+
+static void WriteJsonPhases( OutputBuffer& out, const PhaseTime* phases )
+{
+	out << '{';
+	for( size_t i = 0; i < NUM_PHASES; i++ )
+	{
+		out << ( i ? ",\"" : "\"" ) << PhaseName( (Phase)i ) << "\":";
+		WriteJsonTime( out, phases[i] );
+	}
+	out << '}';
+}
+
+static void WriteJsonAllocCount( OutputBuffer& out, const AllocCount& count )
+{
+	out << "{\"count\":" << count.count << ",\"bytes\":" << count.bytes << '}';
+}
+
+static void WriteJsonAllocs( OutputBuffer& out, const FunctionStats& stats )
+{
+	out << "\"allocs\":{\"total\":";
+	WriteJsonAllocCount( out, stats.total_allocs );
+	out << ",\"phases\":{";
+	for( size_t i = 0; i < NUM_PHASES; i++ )
+	{
+		out << ( i ? ",\"" : "\"" ) << PhaseName( (Phase)i ) << "\":";
+		WriteJsonAllocCount( out, stats.allocs[i] );
+	}
+	out << "},\"nodes\":{";
+	bool first = true;
+	for( const auto& [kind, count] : stats.node_allocs )
+	{
+		out << ( first ? "" : "," );
+		out.WriteJsonString( kind );
+		out << ':';
+		WriteJsonAllocCount( out, count );
+		first = false;
+	}
+	out << "}}";
+}
+
+static void WriteJsonCounts( OutputBuffer& out, const FunctionStats& stats )
+{
+	out << "\"blocks\":" << stats.num_blocks
+		<< ",\"il_nodes\":" << stats.num_il_nodes
+		<< ",\"phis\":" << stats.num_phis
+		<< ",\"temps\":" << stats.num_temps
+		<< ",\"gotos\":" << stats.num_gotos
+		<< ",\"derived_levels\":" << stats.num_derived_levels
+		<< ",\"fixup_rounds\":" << stats.num_fixup_rounds;
+}
+
+void DecompileStats::WriteJson( OutputBuffer& out ) const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	const bool allocs = AllocTracker::enabled();
+	Totals totals;
+
+	out << "{\"files\":[";
+	for( size_t f = 0; f < files_.size(); f++ )
+	{
+		const FileStats& file = files_[f];
+		totals.Add( file );
+
+		out << ( f ? ",\n" : "\n" ) << "{\"path\":";
+		out.WriteJsonString( file.path );
+		out << ",\"load\":";
+		WriteJsonTime( out, file.load );
+		if( allocs )
+			out << ",\"peak_rss_bytes\":" << file.peak_rss;
+		out << ",\"functions\":[";
+		for( size_t i = 0; i < file.functions.size(); i++ )
+		{
+			const FunctionStats& func = file.functions[i];
+			out << ( i ? ",\n" : "\n" ) << "{\"name\":";
+			out.WriteJsonString( func.name );
+			out << ",\"total\":";
+			WriteJsonTime( out, func.total() );
+			out << ",\"phases\":";
+			WriteJsonPhases( out, func.phases );
+			out << ',';
+			WriteJsonCounts( out, func );
+			if( allocs )
+			{
+				out << ',';
+				WriteJsonAllocs( out, func );
+			}
+			out << '}';
+		}
+		out << "]}";
+	}
+
+	out << "],\n\"totals\":{\"files\":" << files_.size() << ",\"functions\":" << totals.num_functions << ",\"load\":";
+	WriteJsonTime( out, totals.load );
+	out << ",\"phases\":";
+	WriteJsonPhases( out, totals.phases );
+	out << ',';
+	WriteJsonCounts( out, totals.counts );
+	out << ",\"max_derived_levels\":" << totals.max_derived_levels
+		<< ",\"max_fixup_rounds\":" << totals.max_fixup_rounds;
+	if( allocs )
+	{
+		out << ',';
+		WriteJsonAllocs( out, totals.counts );
+		out << ",\"peak_rss_bytes\":" << totals.peak_rss;
+	}
+	out << "}}\n";
+}
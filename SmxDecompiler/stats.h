@@ -0,0 +1,166 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "trace.h"
+
+class OutputBuffer;
+
+// The phases every function goes through, in order. Loading happens once per file and is kept
+// apart from these.
+enum class Phase
+{
+	CFG,
+	LIFT,
+	FIXUP,
+	DERIVED,
+	STRUCTURE,
+	WRITE,
+	NUM_PHASES
+};
+
+constexpr size_t NUM_PHASES = (size_t)Phase::NUM_PHASES;
+
+const char* PhaseName( Phase phase );
+
+struct PhaseTime
+{
+	double wall_ms = 0.0;
+	// CPU time of the thread that ran the phase
+	double cpu_ms = 0.0;
+
+	PhaseTime& operator+=( const PhaseTime& other )
+	{
+		wall_ms += other.wall_ms;
+		cpu_ms += other.cpu_ms;
+		return *this;
+	}
+};
+
+struct AllocCount
+{
+	size_t count = 0;
+	size_t bytes = 0;
+
+	void Add( size_t size )
+	{
+		count++;
+		bytes += size;
+	}
+	AllocCount& operator+=( const AllocCount& other )
+	{
+		count += other.count;
+		bytes += other.bytes;
+		return *this;
+	}
+};
+
+// Measures the wall time and the CPU time of the calling thread since it was started
+class Stopwatch
+{
+public:
+	void Start();
+	PhaseTime Elapsed() const;
+private:
+	std::chrono::steady_clock::time_point wall_start_;
+	double cpu_start_ms_ = 0.0;
+};
+
+struct FunctionStats
+{
+	std::string name;
+	PhaseTime phases[NUM_PHASES];
+
+	size_t num_blocks = 0;
+	size_t num_il_nodes = 0;
+	size_t num_phis = 0;
+	size_t num_temps = 0;
+	size_t num_gotos = 0;
+	size_t num_derived_levels = 0;
+	size_t num_fixup_rounds = 0;
+
+	// Only filled in while the AllocTracker runs. Allocations outside of any phase only count
+	// towards the total. Nodes are counted by kind at their own size, not including the memory
+	// they point to.
+	AllocCount allocs[NUM_PHASES];
+	AllocCount total_allocs;
+	std::map<std::string, AllocCount> node_allocs;
+
+	PhaseTime total() const;
+
+	// Makes the phases running on the current thread count into stats until the scope ends.
+	// Like node pools, the stats of a function may move between threads one phase at a time.
+	class Scope
+	{
+	public:
+		explicit Scope( FunctionStats* stats );
+		Scope( const Scope& ) = delete;
+		Scope& operator=( const Scope& ) = delete;
+		~Scope();
+	private:
+		FunctionStats* prev_;
+	};
+
+	// The stats of the function being worked on by the current thread, if they are collected
+	static FunctionStats* current() { return current_; }
+private:
+	static thread_local FunctionStats* current_;
+};
+
+// Adds the time until the end of its scope to a phase of the current function. An inner timer
+// pauses the outer one, so time is only counted for the innermost phase. Without a current
+// function it does nothing, not even read the clock. When tracing, it also records the phase as
+// a span.
+class PhaseTimer
+{
+public:
+	explicit PhaseTimer( Phase phase );
+	PhaseTimer( const PhaseTimer& ) = delete;
+	PhaseTimer& operator=( const PhaseTimer& ) = delete;
+	~PhaseTimer();
+
+	// The phase running on the current thread, if its time is being counted
+	static const PhaseTimer* innermost() { return innermost_; }
+	Phase phase() const { return phase_; }
+private:
+	void Stop();
+private:
+	FunctionStats* stats_;
+	Phase phase_;
+	Stopwatch watch_;
+	PhaseTimer* outer_ = nullptr;
+	TraceSpan span_;
+
+	static thread_local PhaseTimer* innermost_;
+};
+
+struct FileStats
+{
+	std::string path;
+	PhaseTime load;
+	// Peak resident memory of the whole process when the file was done, while the AllocTracker runs
+	size_t peak_rss = 0;
+	// Selected functions in file order
+	std::vector<FunctionStats> functions;
+};
+
+// Stats of a whole run. Files may be added from any thread, each file is then filled in by
+// whoever decompiles it.
+class DecompileStats
+{
+public:
+	// The reference stays valid for the lifetime of the stats
+	FileStats& AddFile( const std::string& path, const PhaseTime& load );
+
+	// Every function on a line of its own, then the totals of every phase and counter
+	void WriteText( std::ostream& out ) const;
+	void WriteJson( OutputBuffer& out ) const;
+private:
+	mutable std::mutex mutex_;
+	std::deque<FileStats> files_;
+};
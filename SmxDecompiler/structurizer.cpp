@@ -1,17 +1,28 @@
 #include "structurizer.h"
 
 #include "il.h"
+#include "stats.h"
 
-Structurizer::Structurizer( ILControlFlowGraph* cfg )
+#include <algorithm>
+#include <numeric>
+
+static void CountGoto()
+{
+	if( FunctionStats* stats = FunctionStats::current() )
+		stats->num_gotos++;
+}
+
+Structurizer::Structurizer( ILControlFlowGraph* cfg, StructurizerEngine engine ) :
+	cfg_( cfg ),
+	engine_( engine )
 {
-	derived_.push_back( cfg );
-	ILControlFlowGraph* curr = derived_.back();
-	ILControlFlowGraph* next = curr->Next();
-	while( curr->num_blocks() != next->num_blocks() )
+	if( engine_ == StructurizerEngine::INTERVALS )
 	{
-		derived_.push_back( next );
-		curr = derived_.back();
-		next = curr->Next();
+		PhaseTimer timer( Phase::DERIVED );
+		derived_.emplace( *cfg );
+
+		if( FunctionStats* stats = FunctionStats::current() )
+			stats->num_derived_levels = derived_->num_levels();
 	}
 
 	loop_heads_.resize( cfg->max_id() + 1, nullptr );
@@ -22,45 +33,42 @@ Structurizer::Structurizer( ILControlFlowGraph* cfg )
 
 Statement* Structurizer::Transform()
 {
-	MarkLoops();
+	PhaseTimer timer( Phase::STRUCTURE );
+	if( engine_ == StructurizerEngine::INTERVALS )
+		MarkLoops();
+	else
+		MarkNaturalLoops();
 	MarkIfs();
 
 	cfg()->NewEpoch();
 	return CreateStatement( &cfg()->block( 0 ) );
 }
 
-void Structurizer::FindBlocksInInterval( ILBlock* interval, size_t level, std::vector<ILBlock*>& blocks )
-{
-	if( level > 0 )
-	{
-		for( size_t i = 0; i < interval->num_nodes(); i++ )
-		{
-			ILInterval* I = static_cast<ILInterval*>( interval->node( i ) );
-			FindBlocksInInterval( I->block(), level - 1, blocks );
-		}
-	}
-	else
-	{
-		blocks.push_back( interval );
-	}
-}
-
-void Structurizer::FindBlocksInLoop( ILBlock* head, ILBlock* latch, const std::vector<ILBlock*>& interval )
+void Structurizer::FindBlocksInLoop( ILBlock* head, ILBlock* latch, size_t interval )
 {
 	LoopHead( head ) = head;
-	for( size_t i = head->id() + 1; i < latch->id(); i++ )
+
+	// Only blocks of the interval can be in the loop, so just walk those between head and latch
+	auto begin = interval_blocks_.begin() + interval_start_[interval];
+	auto end = interval_blocks_.begin() + interval_start_[interval + 1];
+	auto it = std::upper_bound( begin, end, head->id(), []( size_t id, ILBlock* bb ) { return id < bb->id(); } );
+	for( ; it != end && (*it)->id() < latch->id(); it++ )
 	{
-		ILBlock* bb = &derived_[0]->block( i );
+		ILBlock* bb = *it;
 		ILBlock* immed_dominator = bb->immed_dominator();
 		if( LoopHead( immed_dominator ) == head &&
-			LoopHead( bb ) == nullptr &&
-			std::find( interval.begin(), interval.end(), bb ) != interval.end() )
+			LoopHead( bb ) == nullptr )
 		{
 			LoopHead( bb ) = head;
 		}
 	}
 	LoopHead( latch ) = head;
 
+	SetLoopLatch( head, latch );
+}
+
+void Structurizer::SetLoopLatch( ILBlock* head, ILBlock* latch )
+{
 	bool all_edges_loop = true;
 	for( size_t i = 0; i < head->num_out_edges(); i++ )
 	{
@@ -89,21 +97,18 @@ void Structurizer::FindBlocksInLoop( ILBlock* head, ILBlock* latch, const std::v
 
 void Structurizer::MarkLoops()
 {
-	std::vector<ILBlock*> blocks;
+	block_interval_.resize( cfg()->num_blocks() );
+	for( size_t i = 0; i < cfg()->num_blocks(); i++ )
+		block_interval_[i] = i;
 
-	for( size_t level = 1; level < derived_.size(); level++ )
+	for( size_t level = 1; level < derived_->num_levels(); level++ )
 	{
-		ILControlFlowGraph* G = derived_[level];
+		GroupBlocksByInterval( level );
 
-		for( size_t Ii = 0; Ii < G->num_blocks(); Ii++ )
+		for( size_t Ii = 0; Ii < derived_->num_intervals( level ); Ii++ )
 		{
 			ILBlock* latch = nullptr;
-			blocks.clear();
-
-			// Get interval basic blocks
-			FindBlocksInInterval( &G->block( Ii ), level, blocks );
-
-			ILBlock* head = blocks[0];
+			ILBlock* head = &derived_->header( level, Ii );
 
 			// Find greatest back edge in current interval
 			for( size_t i = 0; i < head->num_in_edges(); i++ )
@@ -115,7 +120,7 @@ void Structurizer::MarkLoops()
 					continue;
 				
 				// Must be in current interval
-				if( std::find( blocks.begin(), blocks.end(), pred ) == blocks.end() )
+				if( block_interval_[pred->id()] != Ii )
 					continue;
 
 				if( !latch || ( pred->id() > latch->id() ) )
@@ -126,12 +131,149 @@ void Structurizer::MarkLoops()
 
 			if( latch && LoopHead( latch ) == nullptr )
 			{
-				FindBlocksInLoop( head, latch, blocks );
+				FindBlocksInLoop( head, latch, Ii );
 			}
 		}
 	}
 }
 
+void Structurizer::GroupBlocksByInterval( size_t level )
+{
+	// Levels are visited in order, so the interval of every block only needs to be mapped one
+	// level further
+	for( size_t& interval : block_interval_ )
+		interval = derived_->owner( level, interval );
+
+	// Counting sort of the blocks by their interval, blocks stay ordered by id within an interval
+	size_t num_intervals = derived_->num_intervals( level );
+	interval_start_.assign( num_intervals + 1, 0 );
+	for( size_t i = 0; i < cfg()->num_blocks(); i++ )
+		interval_start_[block_interval_[i] + 1]++;
+	for( size_t i = 0; i < num_intervals; i++ )
+		interval_start_[i + 1] += interval_start_[i];
+
+	interval_blocks_.resize( cfg()->num_blocks() );
+	std::vector<size_t> next( interval_start_.begin(), interval_start_.end() - 1 );
+	for( size_t i = 0; i < cfg()->num_blocks(); i++ )
+	{
+		ILBlock* bb = &cfg()->block( i );
+		interval_blocks_[next[block_interval_[i]]++] = bb;
+	}
+}
+
+void Structurizer::NumberDominatorTree()
+{
+	constexpr size_t NONE = (size_t)-1;
+	dom_pre_.assign( cfg()->num_blocks(), NONE );
+	dom_post_.assign( cfg()->num_blocks(), NONE );
+
+	// Iterative depth first walk over the dominator tree, each entry is a block and the index of
+	// the next child to visit
+	std::vector<std::pair<ILBlock*, size_t>> stack;
+	size_t pre = 0;
+	size_t post = 0;
+	ILBlock* entry = &cfg()->block( 0 );
+	dom_pre_[entry->id()] = pre++;
+	stack.emplace_back( entry, 0 );
+	while( !stack.empty() )
+	{
+		auto& [bb, child] = stack.back();
+		if( child == bb->num_dom_children() )
+		{
+			dom_post_[bb->id()] = post++;
+			stack.pop_back();
+			continue;
+		}
+
+		ILBlock* next = &bb->dom_child( child++ );
+		if( dom_pre_[next->id()] != NONE )
+			continue;
+
+		dom_pre_[next->id()] = pre++;
+		stack.emplace_back( next, 0 );
+	}
+}
+
+bool Structurizer::Dominates( ILBlock* a, ILBlock* b ) const
+{
+	// Blocks that aren't reachable don't have numbers, and aren't dominated by anything
+	if( dom_post_[b->id()] == (size_t)-1 )
+		return false;
+
+	return dom_pre_[a->id()] <= dom_pre_[b->id()] && dom_post_[b->id()] <= dom_post_[a->id()];
+}
+
+void Structurizer::MarkNaturalLoops()
+{
+	// A back edge goes to a block that dominates its source. The loop of a header is every block
+	// that reaches one of those back edges without going through the header. Inner loops have
+	// higher ids than the loops around them, so walking the headers from the last one finds the
+	// inner loops first. The blocks of a finished loop are then merged into its header, which makes
+	// outer loops step over the inner ones instead of walking them again.
+	NumberDominatorTree();
+
+	size_t num_blocks = cfg()->num_blocks();
+	std::vector<size_t> merged_into( num_blocks );
+	std::iota( merged_into.begin(), merged_into.end(), 0 );
+	auto find = [&]( size_t id ) {
+		while( merged_into[id] != id )
+		{
+			merged_into[id] = merged_into[merged_into[id]];
+			id = merged_into[id];
+		}
+		return id;
+	};
+
+	constexpr size_t NONE = (size_t)-1;
+	std::vector<size_t> walked_by( num_blocks, NONE );
+	std::vector<ILBlock*> work;
+	for( size_t i = num_blocks; i-- > 0; )
+	{
+		ILBlock* head = &cfg()->block( i );
+
+		// The greatest back edge is the latch, same as with intervals
+		ILBlock* latch = nullptr;
+		work.clear();
+		for( size_t j = 0; j < head->num_in_edges(); j++ )
+		{
+			ILBlock* pred = &head->in_edge( j );
+			if( pred->id() <= head->id() || !Dominates( head, pred ) )
+				continue;
+
+			work.push_back( pred );
+			if( !latch || pred->id() > latch->id() )
+				latch = pred;
+		}
+
+		if( !latch || LoopHead( latch ) != nullptr )
+			continue;
+
+		LoopHead( head ) = head;
+		walked_by[i] = i;
+		while( !work.empty() )
+		{
+			ILBlock* bb = &cfg()->block( find( work.back()->id() ) );
+			work.pop_back();
+			if( walked_by[bb->id()] == i )
+				continue;
+
+			walked_by[bb->id()] = i;
+			merged_into[bb->id()] = i;
+			if( LoopHead( bb ) == nullptr )
+				LoopHead( bb ) = head;
+
+			for( size_t j = 0; j < bb->num_in_edges(); j++ )
+			{
+				ILBlock* pred = &bb->in_edge( j );
+				if( Dominates( head, pred ) )
+					work.push_back( pred );
+			}
+		}
+
+		SetLoopLatch( head, latch );
+	}
+}
+
 void Structurizer::MarkIfs()
 {
 	for( int i = (int)cfg()->num_blocks() - 1; i >= 0; i-- )
@@ -146,28 +288,82 @@ void Structurizer::MarkIfs()
 		if( bb->immed_post_dominator() != bb )
 		{
 			IfFollow( bb ) = bb->immed_post_dominator();
+			continue;
 		}
-		else
+
+		// Without a post dominator the follow is the first block after this one that it
+		// immediately dominates, other than the branches themselves
+		ILBlock* follow = nullptr;
+		for( size_t j = 0; j < bb->num_dom_children(); j++ )
 		{
-			for( int j = i + 1; j < cfg()->num_blocks(); j++ )
-			{
-				ILBlock* potential_follow = &cfg()->block( j );
-				if( potential_follow->immed_dominator() == bb &&
-					potential_follow != &bb->out_edge( 0 ) &&
-					potential_follow != &bb->out_edge( 1 ) )
-				{
-					IfFollow( bb ) = potential_follow;
-					break;
-				}
-			}
+			ILBlock* potential_follow = &bb->dom_child( j );
+			if( potential_follow->id() <= bb->id() ||
+				potential_follow == &bb->out_edge( 0 ) ||
+				potential_follow == &bb->out_edge( 1 ) )
+				continue;
+
+			if( !follow || potential_follow->id() < follow->id() )
+				follow = potential_follow;
 		}
+
+		IfFollow( bb ) = follow;
 	}
 }
 
 Statement* Structurizer::CreateStatement( ILBlock* bb )
 {
+	// The statements are built depth first with an explicit stack instead of recursion, the chain of
+	// next statements is as long as the function and would overflow the native stack
+	Call( Frame::STATEMENT, bb );
+	while( !frames_.empty() )
+	{
+		switch( frames_.back().kind )
+		{
+		case Frame::STATEMENT: StatementStep(); break;
+		case Frame::NON_LOOP:  NonLoopStep(); break;
+		case Frame::DO_WHILE:  DoWhileStep(); break;
+		case Frame::ENDLESS:   EndlessStep(); break;
+		case Frame::WHILE:     WhileStep(); break;
+		case Frame::IF:        IfStep(); break;
+		case Frame::SWITCH:    SwitchStep(); break;
+		}
+	}
+
+	return result_;
+}
+
+void Structurizer::Call( Frame::Kind kind, ILBlock* bb )
+{
+	frames_.emplace_back( kind, bb );
+}
+
+void Structurizer::Return( Statement* stmt )
+{
+	result_ = stmt;
+	frames_.pop_back();
+}
+
+void Structurizer::StatementStep()
+{
+	Frame& frame = frames_.back();
+	ILBlock* bb = frame.bb;
+
+	if( frame.state == 1 )
+	{
+		// The loop or non-loop statement for this block is done
+		Statement* stmt = result_;
+		StatementForBlock( bb ) = stmt;
+		bb->SetVisited();
+
+		Return( stmt );
+		return;
+	}
+
 	if( !bb )
-		return nullptr;
+	{
+		Return( nullptr );
+		return;
+	}
 
 	const Scope* outer_scope = FindInOuterScope( bb );
 	if( outer_scope &&
@@ -177,59 +373,68 @@ Statement* Structurizer::CreateStatement( ILBlock* bb )
 	{
 		if( outer_scope->type == ScopeType::BREAK )
 		{
-			return new BreakStatement;
+			Return( arena_.New<BreakStatement>() );
+			return;
 		}
 		else if( outer_scope->type == ScopeType::CONTINUE )
 		{
-			return new ContinueStatement;
+			Return( arena_.New<ContinueStatement>() );
+			return;
 		}
 
 		assert( !"Unhandled scope type" );
-		return new GotoStatement( StatementForBlock( bb ) );
+		CountGoto();
+		Return( arena_.New<GotoStatement>( StatementForBlock( bb ) ) );
+		return;
 	}
 
-	Statement* stmt;
 	if( bb->IsVisited() )
 	{
-		stmt = StatementForBlock( bb );
+		Statement* stmt = StatementForBlock( bb );
 		assert( stmt );
 		if( !stmt->label() )
 			stmt->CreateLabel( bb->pc() );
-		return new GotoStatement( stmt );
+		CountGoto();
+		Return( arena_.New<GotoStatement>( stmt ) );
+		return;
 	}
 
 	if( outer_scope )
 	{
 		if( outer_scope->type == ScopeType::LATCH )
-			return new BasicStatement( bb, nullptr );
-	
-		return nullptr;
+			Return( arena_.New<BasicStatement>( bb, nullptr ) );
+		else
+			Return( nullptr );
+		return;
 	}
 
+	frame.state = 1;
 	if( LoopHead( bb ) == bb )
 	{
-		stmt = CreateLoopStatement( bb );
+		ILBlock* latch = LoopLatch( bb );
+		Frame::Kind kind;
+		if( !FindLoopKind( bb, latch, &kind ) )
+		{
+			result_ = nullptr;
+			return;
+		}
+
+		Call( kind, bb );
+		frames_.back().latch = latch;
 	}
 	else
 	{
-		stmt = CreateNonLoopStatement( bb );
+		Call( Frame::NON_LOOP, bb );
 	}
-
-	StatementForBlock( bb ) = stmt;
-	bb->SetVisited();
-
-	return stmt;
 }
 
-Statement* Structurizer::CreateLoopStatement( ILBlock* bb )
+bool Structurizer::FindLoopKind( ILBlock* head, ILBlock* latch, Frame::Kind* kind )
 {
-	ILBlock* head = bb;
-	ILBlock* latch = LoopLatch( head );
-
 	if( latch->num_out_edges() == 2 )
 	{
 		// Condition is at the end of the loop
-		return CreateDoWhileStatement( head, latch );
+		*kind = Frame::DO_WHILE;
+		return true;
 	}
 	if( head->num_out_edges() == 2 && latch->num_out_edges() == 1 )
 	{
@@ -242,213 +447,333 @@ Statement* Structurizer::CreateLoopStatement( ILBlock* bb )
 		if( exit1 == exit2 )
 		{
 			// Both exits are still part of the same loop, this must be endless loop
-			return CreateEndlessStatement( head, latch );
+			*kind = Frame::ENDLESS;
+			return true;
 		}
 
-		return CreateWhileStatement( head, latch );
+		*kind = Frame::WHILE;
+		return true;
 	}
 
-	return nullptr;
+	return false;
 }
 
-Statement* Structurizer::CreateNonLoopStatement( ILBlock* bb )
+void Structurizer::NonLoopStep()
 {
-	if( auto* switch_node = dynamic_cast<ILSwitch*>(bb->Last()) )
+	Frame& frame = frames_.back();
+	ILBlock* bb = frame.bb;
+
+	if( frame.state == 1 )
+	{
+		Return( arena_.New<BasicStatement>( bb, result_ ) );
+		return;
+	}
+
+	if( dynamic_cast<ILSwitch*>( bb->Last() ) )
 	{
-		return CreateSwitchStatement( bb, switch_node );
+		frame.kind = Frame::SWITCH;
 	}
 	else if( bb->num_out_edges() == 2 )
 	{
-		return CreateIfStatement( bb );
+		frame.kind = Frame::IF;
 	}
 	else if( bb->num_out_edges() == 1 )
 	{
 		ILBlock* succ = &bb->out_edge( 0 );
 		const Scope* scope = FindInOuterScope( succ );
 
-		Statement* next_stmt = nullptr;
+		frame.state = 1;
 		if( !scope || scope->type != ScopeType::BASIC )
-			next_stmt = CreateStatement( succ );
-
-		return new BasicStatement( bb, next_stmt );
+			Call( Frame::STATEMENT, succ );
+		else
+			result_ = nullptr;
 	}
 	else
 	{
 		assert( bb->num_out_edges() == 0 );
-		return new BasicStatement( bb, nullptr );
+		Return( arena_.New<BasicStatement>( bb, nullptr ) );
 	}
 }
 
-Statement* Structurizer::CreateDoWhileStatement( ILBlock* head, ILBlock* latch )
+void Structurizer::DoWhileStep()
 {
-	ILBlock* succ1 = &latch->out_edge( 0 );
-	ILBlock* succ2 = &latch->out_edge( 1 );
+	Frame& frame = frames_.back();
+	ILBlock* head = frame.bb;
+	ILBlock* latch = frame.latch;
 
-	// Determine which is the body and which is the follow
-	ILBlock* body;
-	ILBlock* follow;
-	if( latch->IsBackEdge( 0 ) )
+	switch( frame.state )
 	{
-		body = succ1;
-		follow = succ2;
-	}
-	else
+	case 0:
 	{
-		body = succ2;
-		follow = succ1;
-	}
-
-	ILJumpCond* jmp = static_cast<ILJumpCond*>( latch->Last() );
-	if( jmp->true_branch() != body )
-		jmp->Invert();
+		ILBlock* succ1 = &latch->out_edge( 0 );
+		ILBlock* succ2 = &latch->out_edge( 1 );
 
-	PushScope( follow, ScopeType::BREAK );
-	PushScope( latch, ScopeType::CONTINUE );
+		// Determine which is the body and which is the follow
+		ILBlock* body;
+		if( latch->IsBackEdge( 0 ) )
+		{
+			body = succ1;
+			frame.follow = succ2;
+		}
+		else
+		{
+			body = succ2;
+			frame.follow = succ1;
+		}
 
-	Statement* body_stmt = nullptr;
-	if( head != latch )
-		body_stmt = CreateNonLoopStatement( head );
+		frame.jmp = static_cast<ILJumpCond*>( latch->Last() );
+		if( frame.jmp->true_branch() != body )
+			frame.jmp->Invert();
 
-	PopScope();
-	PopScope();
+		PushScope( frame.follow, ScopeType::BREAK );
+		PushScope( latch, ScopeType::CONTINUE );
 
-	Statement* next_stmt = CreateStatement( follow );
-	return new DoWhileStatement( jmp->condition(), body_stmt, next_stmt );
+		frame.state = 1;
+		if( head != latch )
+			Call( Frame::NON_LOOP, head );
+		else
+			result_ = nullptr;
+		break;
+	}
+	case 1:
+		frame.body = result_;
+
+		PopScope();
+		PopScope();
+
+		frame.state = 2;
+		Call( Frame::STATEMENT, frame.follow );
+		break;
+	case 2:
+		Return( arena_.New<DoWhileStatement>( frame.jmp->condition(), frame.body, result_ ) );
+		break;
+	}
 }
 
-Statement* Structurizer::CreateEndlessStatement( ILBlock* head, ILBlock* latch )
+void Structurizer::EndlessStep()
 {
-	ILBlock* follow = head->immed_post_dominator();
-
-	PushScope( head, ScopeType::CONTINUE );
-	PushScope( follow, ScopeType::BREAK );
-	PushScope( latch, ScopeType::LATCH );
+	Frame& frame = frames_.back();
+	ILBlock* head = frame.bb;
+	ILBlock* latch = frame.latch;
 
-	Statement* body_stmt = nullptr;
-	if( head != latch )
-		body_stmt = CreateNonLoopStatement( head );
+	switch( frame.state )
+	{
+	case 0:
+		frame.follow = head->immed_post_dominator();
 
-	PopScope();
-	PopScope();
-	PopScope();
+		PushScope( head, ScopeType::CONTINUE );
+		PushScope( frame.follow, ScopeType::BREAK );
+		PushScope( latch, ScopeType::LATCH );
 
-	Statement* next_stmt = CreateStatement( follow );
-	return new EndlessStatement( body_stmt, next_stmt );
+		frame.state = 1;
+		if( head != latch )
+			Call( Frame::NON_LOOP, head );
+		else
+			result_ = nullptr;
+		break;
+	case 1:
+		frame.body = result_;
+
+		PopScope();
+		PopScope();
+		PopScope();
+
+		frame.state = 2;
+		Call( Frame::STATEMENT, frame.follow );
+		break;
+	case 2:
+		Return( arena_.New<EndlessStatement>( frame.body, result_ ) );
+		break;
+	}
 }
 
-Statement* Structurizer::CreateWhileStatement( ILBlock* head, ILBlock* latch )
+void Structurizer::WhileStep()
 {
-	ILBlock* succ1 = &head->out_edge( 0 );
-	ILBlock* succ2 = &head->out_edge( 1 );
+	Frame& frame = frames_.back();
+	ILBlock* head = frame.bb;
+	ILBlock* latch = frame.latch;
 
-	// Determine which is the body and which is the follow
-	ILBlock* body;
-	ILBlock* follow;
-	if( LoopHead( succ1 ) == head )
+	switch( frame.state )
 	{
-		body = succ1;
-		follow = succ2;
-	}
-	else
+	case 0:
 	{
-		body = succ2;
-		follow = succ1;
-	}
+		ILBlock* succ1 = &head->out_edge( 0 );
+		ILBlock* succ2 = &head->out_edge( 1 );
 
-	ILJumpCond* jmp = static_cast<ILJumpCond*>(head->Last());
-	if( jmp->true_branch() != body )
-		jmp->Invert();
-
-	PushScope( head, ScopeType::CONTINUE );
-	PushScope( follow, ScopeType::BREAK );
-	PushScope( latch, ScopeType::LATCH );
+		// Determine which is the body and which is the follow
+		ILBlock* body;
+		if( LoopHead( succ1 ) == head )
+		{
+			body = succ1;
+			frame.follow = succ2;
+		}
+		else
+		{
+			body = succ2;
+			frame.follow = succ1;
+		}
 
-	Statement* body_stmt = nullptr;
-	if( head != latch )
-		body_stmt = CreateStatement( body );
+		frame.jmp = static_cast<ILJumpCond*>(head->Last());
+		if( frame.jmp->true_branch() != body )
+			frame.jmp->Invert();
 
-	PopScope();
-	PopScope();
-	PopScope();
+		PushScope( head, ScopeType::CONTINUE );
+		PushScope( frame.follow, ScopeType::BREAK );
+		PushScope( latch, ScopeType::LATCH );
 
-	Statement* next_stmt = CreateStatement( follow );
-	return new WhileStatement( jmp->condition(), body_stmt, next_stmt );
+		frame.state = 1;
+		if( head != latch )
+			Call( Frame::STATEMENT, body );
+		else
+			result_ = nullptr;
+		break;
+	}
+	case 1:
+		frame.body = result_;
+
+		PopScope();
+		PopScope();
+		PopScope();
+
+		frame.state = 2;
+		Call( Frame::STATEMENT, frame.follow );
+		break;
+	case 2:
+		Return( arena_.New<WhileStatement>( frame.jmp->condition(), frame.body, result_ ) );
+		break;
+	}
 }
 
-Statement* Structurizer::CreateIfStatement( ILBlock* bb )
+void Structurizer::IfStep()
 {
-	ILBlock* follow = IfFollow( bb );
-
-	auto* jmp = static_cast<ILJumpCond*>(bb->Last());
-	jmp->Invert();
+	Frame& frame = frames_.back();
+	ILBlock* bb = frame.bb;
 
-	//if( !follow )
-	//{
-	//	follow = jmp->false_branch();
-	//}
+	switch( frame.state )
+	{
+	case 0:
+	{
+		ILBlock* follow = IfFollow( bb );
 
-	if( follow == jmp->true_branch() )
+		auto* jmp = static_cast<ILJumpCond*>(bb->Last());
 		jmp->Invert();
 
-	// Heuristic: If the then branch terminates, then get rid of the else branch
-	// This won't catch cases all the cases where else branch can be removed, is there way to make this more generic?
-	if( jmp->true_branch()->num_out_edges() == 0 )
-	{
-		follow = jmp->false_branch();
-	}
+		//if( !follow )
+		//{
+		//	follow = jmp->false_branch();
+		//}
 
-	PushScope( follow, ScopeType::BASIC );
+		if( follow == jmp->true_branch() )
+			jmp->Invert();
 
-	Statement* then_branch = nullptr;
-	if( jmp->true_branch() != follow )
-		then_branch = CreateStatement( jmp->true_branch() );
-	Statement* else_branch = nullptr;
-	if( jmp->false_branch() != follow )
-		else_branch = CreateStatement( jmp->false_branch() );
+		// Heuristic: If the then branch terminates, then get rid of the else branch
+		// This won't catch cases all the cases where else branch can be removed, is there way to make this more generic?
+		if( jmp->true_branch()->num_out_edges() == 0 )
+		{
+			follow = jmp->false_branch();
+		}
 
-	PopScope();
+		PushScope( follow, ScopeType::BASIC );
 
-	Statement* next_stmt = CreateStatement( follow );
-	Statement* if_stmt = new IfStatement( jmp->condition(), then_branch, else_branch, next_stmt );
+		frame.follow = follow;
+		frame.jmp = jmp;
+		frame.state = 1;
+		if( jmp->true_branch() != follow )
+			Call( Frame::STATEMENT, jmp->true_branch() );
+		else
+			result_ = nullptr;
+		break;
+	}
+	case 1:
+		frame.body = result_;
+
+		frame.state = 2;
+		if( frame.jmp->false_branch() != frame.follow )
+			Call( Frame::STATEMENT, frame.jmp->false_branch() );
+		else
+			result_ = nullptr;
+		break;
+	case 2:
+		frame.other = result_;
+
+		PopScope();
+
+		frame.state = 3;
+		Call( Frame::STATEMENT, frame.follow );
+		break;
+	case 3:
+	{
+		Statement* if_stmt = arena_.New<IfStatement>( frame.jmp->condition(), frame.body, frame.other, result_ );
 
-	// There can be some code before the JumpCond in the head, if there is then add that here too
-	if( bb->num_nodes() > 1 )
-		if_stmt = new BasicStatement( bb, if_stmt );
+		// There can be some code before the JumpCond in the head, if there is then add that here too
+		if( bb->num_nodes() > 1 )
+			if_stmt = arena_.New<BasicStatement>( bb, if_stmt );
 
-	return if_stmt;
+		Return( if_stmt );
+		break;
+	}
+	}
 }
 
-Statement* Structurizer::CreateSwitchStatement( ILBlock* bb, ILSwitch* switch_node )
+void Structurizer::SwitchStep()
 {
-	ILBlock* follow = bb->immed_post_dominator();
+	Frame& frame = frames_.back();
+	ILBlock* bb = frame.bb;
+	auto* switch_node = static_cast<ILSwitch*>(bb->Last());
+
+	switch( frame.state )
+	{
+	case 0:
+		frame.follow = bb->immed_post_dominator();
 
-	// This is intentionally not BREAK, sp has no fall-through on cases so the break is implicit
-	PushScope( follow, ScopeType::BASIC );
+		// This is intentionally not BREAK, sp has no fall-through on cases so the break is implicit
+		PushScope( frame.follow, ScopeType::BASIC );
 
-	Statement* default_case = nullptr;
-	if( switch_node->default_case() != follow )
-		default_case = CreateStatement( switch_node->default_case() );
+		frame.state = 1;
+		if( switch_node->default_case() != frame.follow )
+			Call( Frame::STATEMENT, switch_node->default_case() );
+		else
+			result_ = nullptr;
+		break;
+	case 1:
+		frame.body = result_;
+		frame.cases.reserve( switch_node->num_cases() );
+		frame.state = 2;
+		break;
+	case 2:
+		if( frame.cases.size() < switch_node->num_cases() )
+		{
+			frame.state = 3;
+			Call( Frame::STATEMENT, switch_node->case_entry( frame.cases.size() ).address );
+			break;
+		}
+
+		PopScope();
 
-	std::vector<CaseStatement> cases;
-	cases.reserve( switch_node->num_cases() );
-	for( size_t i = 0; i < switch_node->num_cases(); i++ )
+		frame.state = 4;
+		Call( Frame::STATEMENT, frame.follow );
+		break;
+	case 3:
 	{
 		CaseStatement case_entry;
-		case_entry.body = CreateStatement( switch_node->case_entry( i ).address );
-		case_entry.value = switch_node->case_entry( i ).value;
-		cases.push_back( case_entry );
+		case_entry.body = result_;
+		case_entry.value = switch_node->case_entry( frame.cases.size() ).value;
+		frame.cases.push_back( case_entry );
+		frame.state = 2;
+		break;
 	}
+	case 4:
+	{
+		Statement* switch_stmt = arena_.New<SwitchStatement>( switch_node->value(), frame.body, std::move( frame.cases ), result_ );
 
-	PopScope();
-
-	Statement* next_stmt = CreateStatement( follow );
-	Statement* switch_stmt = new SwitchStatement( switch_node->value(), default_case, std::move( cases ), next_stmt );
-
-	// There can be some code before the Switch in the head, if there is then add that here too
-	if( bb->num_nodes() > 1 )
-		switch_stmt = new BasicStatement( bb, switch_stmt );
+		// There can be some code before the Switch in the head, if there is then add that here too
+		if( bb->num_nodes() > 1 )
+			switch_stmt = arena_.New<BasicStatement>( bb, switch_stmt );
 
-	return switch_stmt;
+		Return( switch_stmt );
+		break;
+	}
+	}
 }
 
 const Structurizer::Scope* Structurizer::FindInOuterScope( ILBlock* block ) const
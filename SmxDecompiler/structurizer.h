@@ -3,11 +3,23 @@
 #include "il-cfg.h"
 #include "statement.h"
 
+#include <optional>
+
+// How the structurizer finds the loops of a function
+enum class StructurizerEngine
+{
+	// Loops within the intervals of the derived sequence of graphs
+	INTERVALS,
+	// Natural loops of the dominator tree, without building any derived graphs
+	REGIONS
+};
+
 class Structurizer
 {
 public:
-	Structurizer( ILControlFlowGraph* cfg );
+	Structurizer( ILControlFlowGraph* cfg, StructurizerEngine engine = StructurizerEngine::INTERVALS );
 
+	// The statements are owned by the structurizer and are freed along with it
 	Statement* Transform();
 private:
 	enum class ScopeType
@@ -28,9 +40,13 @@ private:
 		ScopeType type;
 	};
 
-	void FindBlocksInInterval( ILBlock* interval, size_t level, std::vector<ILBlock*>& blocks );
-	void FindBlocksInLoop( ILBlock* head, ILBlock* latch, const std::vector<ILBlock*>& blocks );
+	void GroupBlocksByInterval( size_t level );
+	void FindBlocksInLoop( ILBlock* head, ILBlock* latch, size_t interval );
+	void SetLoopLatch( ILBlock* head, ILBlock* latch );
 	void MarkLoops();
+	void NumberDominatorTree();
+	bool Dominates( ILBlock* a, ILBlock* b ) const;
+	void MarkNaturalLoops();
 	void MarkIfs();
 	ILBlock*& LoopHead( ILBlock* bb ) { return loop_heads_[bb->id()]; }
 	ILBlock*& LoopLatch( ILBlock* bb ) { return loop_latch_[bb->id()]; }
@@ -38,26 +54,73 @@ private:
 
 	Statement*& StatementForBlock( ILBlock* bb ) { return statements_[bb->id()]; }
 
+	// One pending Create* step of the statement construction. `state` is where the step continues
+	// once the statement it asked for is built, which is then found in `result_`
+	struct Frame
+	{
+		enum Kind
+		{
+			STATEMENT,
+			NON_LOOP,
+			DO_WHILE,
+			ENDLESS,
+			WHILE,
+			IF,
+			SWITCH
+		};
+
+		Frame( Kind kind, ILBlock* bb ) :
+			kind( kind ),
+			bb( bb )
+		{}
+
+		Kind kind;
+		int state = 0;
+		ILBlock* bb;
+		ILBlock* latch = nullptr;
+		ILBlock* follow = nullptr;
+		ILJumpCond* jmp = nullptr;
+		Statement* body = nullptr; // Loop body, then branch or default case
+		Statement* other = nullptr; // Else branch
+		std::vector<CaseStatement> cases;
+	};
+
 	Statement* CreateStatement( ILBlock* bb );
-	Statement* CreateLoopStatement( ILBlock* bb );
-	Statement* CreateNonLoopStatement( ILBlock* bb );
-	Statement* CreateDoWhileStatement( ILBlock* head, ILBlock* latch );
-	Statement* CreateEndlessStatement( ILBlock* head, ILBlock* latch );
-	Statement* CreateWhileStatement( ILBlock* head, ILBlock* latch );
-	Statement* CreateIfStatement( ILBlock* bb );
-	Statement* CreateSwitchStatement( ILBlock* bb, ILSwitch* switch_node );
+	void Call( Frame::Kind kind, ILBlock* bb );
+	void Return( Statement* stmt );
+	bool FindLoopKind( ILBlock* head, ILBlock* latch, Frame::Kind* kind );
+	void StatementStep();
+	void NonLoopStep();
+	void DoWhileStep();
+	void EndlessStep();
+	void WhileStep();
+	void IfStep();
+	void SwitchStep();
 
 	void PushScope( ILBlock* follow, ScopeType type ) { scope_stack_.emplace_back( follow, type ); }
 	void PopScope() { scope_stack_.pop_back(); }
 	const Scope* FindInOuterScope( ILBlock* block ) const;
 	bool CanEmitBreakOrContinue( const Scope* scope ) const;
 
-	ILControlFlowGraph* cfg() { return derived_[0]; }
+	ILControlFlowGraph* cfg() { return cfg_; }
 private:
-	std::vector<ILControlFlowGraph*> derived_;
+	ILControlFlowGraph* cfg_;
+	StructurizerEngine engine_;
+	std::optional<ILDerivedSequence> derived_;
+	// Pre and post order numbers of the blocks in the dominator tree
+	std::vector<size_t> dom_pre_;
+	std::vector<size_t> dom_post_;
+	// Interval of every block in the level that is being searched for loops
+	std::vector<size_t> block_interval_;
+	// Blocks of each interval of that level, ordered by id
+	std::vector<ILBlock*> interval_blocks_;
+	std::vector<size_t> interval_start_;
 	std::vector<ILBlock*> loop_heads_;
 	std::vector<ILBlock*> loop_latch_;
 	std::vector<ILBlock*> if_follow_;
 	std::vector<Scope> scope_stack_;
 	std::vector<Statement*> statements_;
+	StatementArena arena_;
+	std::vector<Frame> frames_;
+	Statement* result_ = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "task-scheduler.h"
+
+#include <algorithm>
+#include <string>
+#include "trace.h"
+
+// Lets tasks submit to the queue of the worker they run on
+static thread_local TaskScheduler* current_scheduler = nullptr;
+static thread_local size_t current_worker = 0;
+
+TaskScheduler::TaskScheduler( size_t num_threads )
+{
+	if( num_threads == 0 )
+		num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+	// All queues have to exist before any worker starts stealing from them
+	workers_.reserve( num_threads );
+	for( size_t i = 0; i < num_threads; i++ )
+		workers_.push_back( std::make_unique<Worker>() );
+	for( size_t i = 0; i < num_threads; i++ )
+		workers_[i]->thread = std::thread( &TaskScheduler::WorkerMain, this, i );
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		stopping_ = true;
+	}
+	work_added_.notify_all();
+
+	for( auto& worker : workers_ )
+		worker->thread.join();
+}
+
+void TaskScheduler::Submit( uint64_t cost, std::function<void()> task )
+{
+	size_t index = current_scheduler == this ? current_worker : next_queue_++ % workers_.size();
+	Worker& worker = *workers_[index];
+
+	num_unfinished_++;
+	{
+		// Equal costs keep their submission order. Submitting in falling cost order, as callers
+		// usually do, always appends.
+		std::lock_guard<std::mutex> lock( worker.mutex );
+		auto it = std::upper_bound( worker.queue.begin(), worker.queue.end(), cost,
+			[]( uint64_t cost, const Task& task ) { return cost > task.cost; } );
+		worker.queue.insert( it, Task{ cost, std::move( task ) } );
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		num_queued_++;
+	}
+	work_added_.notify_one();
+}
+
+void TaskScheduler::WaitAll()
+{
+	std::unique_lock<std::mutex> lock( mutex_ );
+	all_finished_.wait( lock, [this] { return num_unfinished_ == 0; } );
+}
+
+SchedulerStats TaskScheduler::stats() const
+{
+	SchedulerStats stats;
+	stats.num_threads = workers_.size();
+	stats.num_tasks = num_tasks_;
+	stats.num_steals = num_steals_;
+
+	for( const auto& worker : workers_ )
+	{
+		std::lock_guard<std::mutex> lock( worker->mutex );
+		stats.busy_ms += worker->busy_ms;
+	}
+
+	std::lock_guard<std::mutex> lock( mutex_ );
+	if( started_ )
+		stats.wall_ms = std::chrono::duration<double, std::milli>( last_finish_ - first_start_ ).count();
+	return stats;
+}
+
+void TaskScheduler::WorkerMain( size_t index )
+{
+	current_scheduler = this;
+	current_worker = index;
+	Tracer::SetThreadName( "worker " + std::to_string( index ) );
+
+	Worker& worker = *workers_[index];
+	for( ;; )
+	{
+		Task task;
+		if( !TakeTask( index, task ) )
+		{
+			std::unique_lock<std::mutex> lock( mutex_ );
+			work_added_.wait( lock, [this] { return stopping_ || num_queued_ > 0; } );
+
+			// Finish the queues before stopping
+			if( stopping_ && num_queued_ == 0 )
+				return;
+			continue;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			if( !started_ )
+			{
+				started_ = true;
+				first_start_ = start;
+			}
+		}
+
+		task.run();
+
+		auto end = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock( worker.mutex );
+			worker.busy_ms += std::chrono::duration<double, std::milli>( end - start ).count();
+		}
+		num_tasks_++;
+
+		std::lock_guard<std::mutex> lock( mutex_ );
+		last_finish_ = std::max( last_finish_, end );
+		if( --num_unfinished_ == 0 )
+			all_finished_.notify_all();
+	}
+}
+
+bool TaskScheduler::TakeTask( size_t index, Task& task )
+{
+	{
+		Worker& own = *workers_[index];
+		std::lock_guard<std::mutex> lock( own.mutex );
+		if( !own.queue.empty() )
+		{
+			task = std::move( own.queue.front() );
+			own.queue.pop_front();
+			num_queued_--;
+			return true;
+		}
+	}
+
+	// Steal the largest task queued anywhere. Another thief may get to it first, then look again
+	while( num_queued_ > 0 )
+	{
+		size_t victim = index;
+		uint64_t victim_cost = 0;
+		for( size_t i = 0; i < workers_.size(); i++ )
+		{
+			if( i == index )
+				continue;
+
+			std::lock_guard<std::mutex> lock( workers_[i]->mutex );
+			if( !workers_[i]->queue.empty() && ( victim == index || workers_[i]->queue.front().cost > victim_cost ) )
+			{
+				victim = i;
+				victim_cost = workers_[i]->queue.front().cost;
+			}
+		}
+
+		if( victim == index )
+			return false;
+
+		Worker& other = *workers_[victim];
+		std::lock_guard<std::mutex> lock( other.mutex );
+		if( !other.queue.empty() )
+		{
+			task = std::move( other.queue.front() );
+			other.queue.pop_front();
+			num_queued_--;
+			num_steals_++;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SchedulerStats
+{
+	size_t num_threads = 0;
+	size_t num_tasks = 0;
+	size_t num_steals = 0;
+	// From the first task starting to the last one finishing
+	double wall_ms = 0.0;
+	// Time the workers spent running tasks, summed over all workers
+	double busy_ms = 0.0;
+
+	double utilization() const { return wall_ms > 0.0 ? busy_ms / ( wall_ms * num_threads ) : 0.0; }
+};
+
+// Runs tasks on a set of worker threads, largest estimated cost first. Every worker has its own
+// queue, kept sorted by cost, and takes from the front of it. A worker that runs dry steals the
+// largest task queued on any other worker, so a single huge task starts right away instead of
+// being left for the end.
+class TaskScheduler
+{
+public:
+	// 0 threads means one per hardware thread
+	explicit TaskScheduler( size_t num_threads );
+	TaskScheduler( const TaskScheduler& ) = delete;
+	TaskScheduler& operator=( const TaskScheduler& ) = delete;
+	~TaskScheduler();
+
+	// Tasks may submit more tasks. Those go to the queue of the worker running them.
+	void Submit( uint64_t cost, std::function<void()> task );
+	// Blocks until every task, including the ones submitted by tasks, has finished. Must not be
+	// called from a task.
+	void WaitAll();
+
+	size_t num_threads() const { return workers_.size(); }
+	SchedulerStats stats() const;
+private:
+	struct Task
+	{
+		uint64_t cost;
+		std::function<void()> run;
+	};
+
+	struct Worker
+	{
+		std::thread thread;
+		std::mutex mutex;
+		std::deque<Task> queue;
+		double busy_ms = 0.0;
+	};
+
+	void WorkerMain( size_t index );
+	bool TakeTask( size_t index, Task& task );
+private:
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<size_t> next_queue_ = 0;
+
+	std::atomic<size_t> num_queued_ = 0;
+	std::atomic<size_t> num_unfinished_ = 0;
+	std::atomic<size_t> num_tasks_ = 0;
+	std::atomic<size_t> num_steals_ = 0;
+	bool stopping_ = false;
+
+	// Guards sleeping and waking up, and the timing below
+	mutable std::mutex mutex_;
+	std::condition_variable work_added_;
+	std::condition_variable all_finished_;
+
+	bool started_ = false;
+	std::chrono::steady_clock::time_point first_start_;
+	std::chrono::steady_clock::time_point last_finish_;
+};
\ No newline at end of file
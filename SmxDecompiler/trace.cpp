@@ -0,0 +1,147 @@
+#include "trace.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "output-buffer.h"
+
+std::atomic<bool> Tracer::enabled_ = false;
+
+namespace
+{
+	struct Event
+	{
+		char type;
+		const char* category;
+		std::string name;
+		std::string detail;
+		double start_us;
+		double duration_us;
+		uint64_t id;
+	};
+
+	// Events of one thread. Only that thread adds to them, the lock just keeps writing the trace
+	// safe against a thread that is still finishing up.
+	struct ThreadEvents
+	{
+		size_t tid;
+		std::string name;
+		std::vector<Event> events;
+		std::mutex mutex;
+	};
+
+	std::chrono::steady_clock::time_point start_time;
+
+	// Threads come and go, their events stay until the trace is written
+	std::mutex threads_mutex;
+	std::vector<std::unique_ptr<ThreadEvents>> threads;
+	thread_local ThreadEvents* current_thread = nullptr;
+}
+
+static ThreadEvents& CurrentThread()
+{
+	if( !current_thread )
+	{
+		std::lock_guard<std::mutex> lock( threads_mutex );
+		threads.push_back( std::make_unique<ThreadEvents>() );
+		current_thread = threads.back().get();
+		current_thread->tid = threads.size();
+	}
+	return *current_thread;
+}
+
+static void AddEvent( Event&& event )
+{
+	ThreadEvents& thread = CurrentThread();
+	std::lock_guard<std::mutex> lock( thread.mutex );
+	thread.events.push_back( std::move( event ) );
+}
+
+void Tracer::Start()
+{
+	start_time = std::chrono::steady_clock::now();
+	enabled_.store( true, std::memory_order_release );
+}
+
+double Tracer::Now()
+{
+	return std::chrono::duration<double, std::micro>( std::chrono::steady_clock::now() - start_time ).count();
+}
+
+void Tracer::SetThreadName( const std::string& name )
+{
+	if( !enabled() )
+		return;
+
+	ThreadEvents& thread = CurrentThread();
+	std::lock_guard<std::mutex> lock( thread.mutex );
+	thread.name = name;
+}
+
+void Tracer::Complete( const char* category, const char* name, const char* detail, double start_us, double end_us )
+{
+	AddEvent( Event{ 'X', category, name, detail ? detail : "", start_us, end_us - start_us, 0 } );
+}
+
+void Tracer::AsyncBegin( const char* category, const std::string& name, uint64_t id )
+{
+	if( enabled() )
+		AddEvent( Event{ 'b', category, name, "", Now(), 0.0, id } );
+}
+
+void Tracer::AsyncEnd( const char* category, const std::string& name, uint64_t id )
+{
+	if( enabled() )
+		AddEvent( Event{ 'e', category, name, "", Now(), 0.0, id } );
+}
+
+void Tracer::WriteJson( OutputBuffer& out )
+{
+	std::lock_guard<std::mutex> threads_lock( threads_mutex );
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	auto begin_event = [&]() -> OutputBuffer& {
+		out << ( first ? "\n{" : ",\n{" );
+		first = false;
+		return out;
+	};
+
+	for( const auto& thread : threads )
+	{
+		std::lock_guard<std::mutex> lock( thread->mutex );
+		if( !thread->name.empty() )
+		{
+			begin_event() << "\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->tid << ",\"args\":{\"name\":";
+			out.WriteJsonString( thread->name );
+			out << "}}";
+		}
+
+		for( const Event& event : thread->events )
+		{
+			begin_event() << "\"name\":";
+			out.WriteJsonString( event.name );
+			out << ",\"cat\":\"" << event.category << "\",\"ph\":\"" << event.type << "\",\"ts\":";
+			out.WriteFixed( event.start_us, 3 );
+			if( event.type == 'X' )
+			{
+				out << ",\"dur\":";
+				out.WriteFixed( event.duration_us, 3 );
+			}
+			else
+			{
+				out << ",\"id\":" << event.id;
+			}
+			out << ",\"pid\":1,\"tid\":" << thread->tid;
+			if( !event.detail.empty() )
+			{
+				out << ",\"args\":{\"detail\":";
+				out.WriteJsonString( event.detail );
+				out << '}';
+			}
+			out << '}';
+		}
+	}
+	out << "\n]}\n";
+}
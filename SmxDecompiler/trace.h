@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+class OutputBuffer;
+
+// Records what every thread works on as Chrome trace events, for viewing in Perfetto or
+// chrome://tracing. Off unless started, and while off every span costs a single flag check.
+// Events are kept per thread, so recording never waits on other threads.
+class Tracer
+{
+public:
+	static void Start();
+	static bool enabled() { return enabled_.load( std::memory_order_acquire ); }
+
+	// Microseconds since tracing started
+	static double Now();
+
+	// Names the calling thread in the trace
+	static void SetThreadName( const std::string& name );
+
+	// A span on the calling thread. detail is shown with it, may be null.
+	static void Complete( const char* category, const char* name, const char* detail, double start_us, double end_us );
+
+	// A span that may start and end on different threads, such as the time a file is in flight.
+	// Spans with the same category and id belong together.
+	static void AsyncBegin( const char* category, const std::string& name, uint64_t id );
+	static void AsyncEnd( const char* category, const std::string& name, uint64_t id );
+
+	// Writes every event recorded so far. Must not race with threads still recording.
+	static void WriteJson( OutputBuffer& out );
+private:
+	static std::atomic<bool> enabled_;
+};
+
+// Records the time until the end of its scope as a span of the calling thread. name and detail
+// have to stay alive until then.
+class TraceSpan
+{
+public:
+	TraceSpan( const char* category, const char* name, const char* detail = nullptr )
+		:
+		start_us_( Tracer::enabled() ? Tracer::Now() : -1.0 ),
+		category_( category ),
+		name_( name ),
+		detail_( detail )
+	{}
+	TraceSpan( const TraceSpan& ) = delete;
+	TraceSpan& operator=( const TraceSpan& ) = delete;
+	~TraceSpan()
+	{
+		if( start_us_ >= 0.0 )
+			Tracer::Complete( category_, name_, detail_, start_us_, Tracer::Now() );
+	}
+private:
+	double start_us_;
+	const char* category_;
+	const char* name_;
+	const char* detail_;
+};
@@ -1,6 +1,48 @@
 #include "typer.h"
 
-class SmxVariableVisitor : public RecursiveILVisitor
+// Base for the typer visitors. Counts every node whose type information actually changed, so the
+// pipeline can tell when typing has settled
+class TyperVisitor : public RecursiveILVisitor
+{
+public:
+	size_t num_changes() const { return num_changes_; }
+	std::vector<ILNode*>& changed_nodes() { return changed_nodes_; }
+protected:
+	void SetType( ILNode* node, const SmxVariableType* type )
+	{
+		if( !SameType( node->type(), type ) )
+			Changed( node );
+		node->SetType( type );
+	}
+	void Changed( ILNode* node )
+	{
+		num_changes_++;
+		changed_nodes_.push_back( node );
+	}
+private:
+	static bool SameType( const SmxVariableType* a, const SmxVariableType* b )
+	{
+		// Types built during propagation are canonical, but types read from the file aren't, so
+		// anything that isn't the same pointer still has to be compared by value
+		if( a == b )
+			return true;
+		if( !a || !b )
+			return false;
+		if( a->tag != b->tag || a->dimcount != b->dimcount || a->enum_struct != b->enum_struct )
+			return false;
+		for( int i = 0; i < a->dimcount; i++ )
+		{
+			if( a->dims[i] != b->dims[i] )
+				return false;
+		}
+		return true;
+	}
+private:
+	size_t num_changes_ = 0;
+	std::vector<ILNode*> changed_nodes_;
+};
+
+class SmxVariableVisitor : public TyperVisitor
 {
 public:
 	SmxVariableVisitor( SmxFile& smx, const SmxFunction* func ) :
@@ -10,7 +52,7 @@ public:
 
 	virtual void VisitLocalVar( ILLocalVar* node ) override
 	{
-		RecursiveILVisitor::VisitLocalVar( node );
+		TyperVisitor::VisitLocalVar( node );
 
 		// This has already been filled, can skip
 		if( node->smx_var() )
@@ -21,12 +63,13 @@ public:
 			if( func_->locals[i].address == node->stack_offset() )
 			{
 				node->SetSmxVar( &func_->locals[i] );
+				Changed( node );
 				break;
 			}
 		}
 
 		if( node->smx_var() )
-			node->SetType( &node->smx_var()->type );
+			SetType( node, &node->smx_var()->type );
 	}
 	virtual void VisitGlobalVar( ILGlobalVar* node ) override
 	{
@@ -39,42 +82,43 @@ public:
 			return;
 
 		node->SetSmxVar( var );
-		node->SetType( &var->type );
+		Changed( node );
+		SetType( node, &var->type );
 	}
 	virtual void VisitCall( ILCall* node ) override
 	{
-		RecursiveILVisitor::VisitCall( node );
+		TyperVisitor::VisitCall( node );
 
 		SmxFunction* func = smx_->FindFunctionAt( node->addr() );
 		if( !func )
 			return;
 
-		node->SetType( func->signature.ret );
+		SetType( node, func->signature.ret );
 
 		for( size_t i = 0; i < std::min( func->signature.nargs, node->num_args() ); i++ )
 		{
 			ILNode* arg = node->arg( i );
 			if( arg->type() )
 				continue;
-			arg->SetType( &func->signature.args[i].type );
+			SetType( arg, &func->signature.args[i].type );
 		}
 	}
 	virtual void VisitNative( ILNative* node ) override
 	{
-		RecursiveILVisitor::VisitNative( node );
+		TyperVisitor::VisitNative( node );
 
 		SmxNative* func = smx_->FindNativeByIndex( node->native_index() );
 		if( !func )
 			return;
 
-		node->SetType( func->signature.ret );
+		SetType( node, func->signature.ret );
 
 		for( size_t i = 0; i < std::min(func->signature.nargs, node->num_args()); i++ )
 		{
 			ILNode* arg = node->arg( i );
 			if( arg->type() )
 				continue;
-			arg->SetType( &func->signature.args[i].type );
+			SetType( arg, &func->signature.args[i].type );
 		}
 	}
 private:
@@ -82,20 +126,16 @@ private:
 	const SmxFunction* func_;
 };
 
-class TypePropagator : public ILVisitor
+class TypePropagator : public TyperVisitor
 {
 public:
-	TypePropagator( const SmxFunction* func ) :
+	TypePropagator( SmxFile& smx, const SmxFunction* func ) :
+		smx_( &smx ),
 		func_( func )
 	{
-		int_type_ = new SmxVariableType;
-		int_type_->tag = SmxVariableType::INT;
-
-		bool_type_ = new SmxVariableType;
-		bool_type_->tag = SmxVariableType::BOOL;
-
-		float_type_ = new SmxVariableType;
-		float_type_->tag = SmxVariableType::FLOAT;
+		int_type_ = smx.PrimitiveType( SmxVariableType::INT );
+		bool_type_ = smx.PrimitiveType( SmxVariableType::BOOL );
+		float_type_ = smx.PrimitiveType( SmxVariableType::FLOAT );
 	}
 
 	void Visit( ILNode* node )
@@ -106,14 +146,14 @@ public:
 	virtual void VisitConst( ILConst* node ) override
 	{
 		if( !node->type() )
-			node->SetType( type() );
+			SetType( node, type() );
 	}
 	virtual void VisitUnary( ILUnary* node ) override
 	{
 		switch( node->op() )
 		{	
 		case ILUnary::NOT:
-			node->SetType( bool_type_ );
+			SetType( node, bool_type_ );
 			PushType( type() );
 			break;
 
@@ -121,7 +161,7 @@ public:
 		case ILUnary::INVERT:
 		case ILUnary::INC:
 		case ILUnary::DEC:
-			node->SetType( int_type_ );
+			SetType( node, int_type_ );
 			PushType( int_type_ );
 			break;
 
@@ -132,7 +172,7 @@ public:
 		case ILUnary::RND_TO_CEIL:
 		case ILUnary::RND_TO_ZERO:
 		case ILUnary::RND_TO_FLOOR:
-			node->SetType( float_type_ );
+			SetType( node, float_type_ );
 			PushType( float_type_ );
 			break;
 		
@@ -161,7 +201,7 @@ public:
 			case ILBinary::BITAND:
 			case ILBinary::BITOR:
 			case ILBinary::XOR:
-				node->SetType( int_type_ );
+				SetType( node, int_type_ );
 				break;
 
 			case ILBinary::EQ:
@@ -172,14 +212,14 @@ public:
 			case ILBinary::SLEQ:
 			case ILBinary::AND:
 			case ILBinary::OR:
-				node->SetType( bool_type_ );
+				SetType( node, bool_type_ );
 				break;
 
 			case ILBinary::FLOATADD:
 			case ILBinary::FLOATSUB:
 			case ILBinary::FLOATMUL:
 			case ILBinary::FLOATDIV:
-				node->SetType( float_type_ );
+				SetType( node, float_type_ );
 				break;
 
 			case ILBinary::FLOATCMP:
@@ -189,7 +229,7 @@ public:
 			case ILBinary::FLOATLT:
 			case ILBinary::FLOATEQ:
 			case ILBinary::FLOATNE:
-				node->SetType( bool_type_ );
+				SetType( node, bool_type_ );
 				break;
 
 			default:
@@ -211,7 +251,7 @@ public:
 	virtual void VisitLocalVar( ILLocalVar* node ) override
 	{
 		if( !node->type() )
-			node->SetType( type() );
+			SetType( node, type() );
 
 		if( node->value() )
 		{
@@ -223,30 +263,20 @@ public:
 	virtual void VisitGlobalVar( ILGlobalVar* node ) override
 	{
 		if( !node->type() )
-			node->SetType( type() );
+			SetType( node, type() );
 	}
 	virtual void VisitHeapVar( ILHeapVar* node ) override
 	{
 		if( !node->type() )
-			node->SetType( type() );
+			SetType( node, type() );
 	}
 	virtual void VisitArrayElementVar( ILArrayElementVar* node ) override
 	{
-		node->SetType( type() );
+		SetType( node, type() );
 
-		SmxVariableType* arr_type = nullptr;
+		const SmxVariableType* arr_type = nullptr;
 		if( const SmxVariableType* old_type = type() )
-		{
-			arr_type = new SmxVariableType( *old_type );
-
-			int* dims = new int[arr_type->dimcount + 1];
-			for( int i = 0; i < arr_type->dimcount; i++ )
-			{
-				dims[i] = old_type->dims[i];
-			}
-			dims[arr_type->dimcount++] = 0;
-			arr_type->dims = dims;
-		}
+			arr_type = smx_->ArrayType( *old_type );
 
 		PushType( arr_type );
 		Visit( node->base() );
@@ -259,19 +289,19 @@ public:
 	virtual void VisitFieldVar( ILFieldVar* node ) override
 	{
 		if( !node->type() )
-			node->SetType( type() );
+			SetType( node, type() );
 
 		Visit( node->base() );
 	}
 	virtual void VisitTempVar( ILTempVar* node ) override
 	{
 		if( !node->type() )
-			node->SetType( type() );
+			SetType( node, type() );
 	}
 	virtual void VisitLoad( ILLoad* node ) override
 	{
 		Visit( node->var() );
-		node->SetType( node->var()->type() );
+		SetType( node, node->var()->type() );
 	}
 	virtual void VisitStore( ILStore* node ) override
 	{
@@ -282,9 +312,7 @@ public:
 		{
 			assert( var_type->dimcount == 1 );
 
-			SmxVariableType* inner_type = new SmxVariableType;
-			inner_type->tag = var_type->tag;
-			var_type = inner_type;
+			var_type = smx_->PrimitiveType( var_type->tag );
 		}
 
 		PushType( var_type );
@@ -299,12 +327,12 @@ public:
 	virtual void VisitCall( ILCall* node ) override
 	{
 		if( !node->type() )
-			node->SetType( type() );
+			SetType( node, type() );
 	}
 	virtual void VisitNative( ILNative* node ) override
 	{
 		if( !node->type() )
-			node->SetType( type() );
+			SetType( node, type() );
 	}
 	virtual void VisitReturn( ILReturn* node ) override
 	{
@@ -320,14 +348,15 @@ private:
 	void PushType( const SmxVariableType* type ) { type_stack_.push_back( type ); }
 	void PopType() { type_stack_.pop_back(); }
 private:
+	SmxFile* smx_;
 	const SmxFunction* func_;
-	SmxVariableType* int_type_;
-	SmxVariableType* bool_type_;
-	SmxVariableType* float_type_;
+	const SmxVariableType* int_type_;
+	const SmxVariableType* bool_type_;
+	const SmxVariableType* float_type_;
 	std::vector<const SmxVariableType*> type_stack_;
 };
 
-class StructFinder : public RecursiveILVisitor
+class StructFinder : public TyperVisitor
 {
 public:
 	virtual void VisitArrayElementVar( ILArrayElementVar* node ) override
@@ -357,6 +386,8 @@ public:
 		auto* new_node = new ILFieldVar( var, (size_t)offset->value(), field );
 		new_node->SetType( &field->type );
 
+		if( node->num_uses() )
+			Changed( new_node );
 		node->ReplaceUsesWith( new_node );
 	}
 };
@@ -369,13 +400,13 @@ void Typer::PopulateTypes( ILControlFlowGraph& cfg )
 	FillSmxVars( cfg, func );
 
 	StructFinder struct_finder;
-	VisitAllNodes( cfg, struct_finder );
+	VisitDirty( cfg, struct_finder, FIND_STRUCTS );
 }
 
 void Typer::FillSmxVars( ILControlFlowGraph& cfg, const SmxFunction* func )
 {
 	SmxVariableVisitor fill_smx_vars( *smx_, func );
-	VisitAllNodes( cfg, fill_smx_vars );
+	VisitDirty( cfg, fill_smx_vars, FILL_SMX_VARS );
 }
 
 void Typer::PropagateTypes( ILControlFlowGraph& cfg )
@@ -383,21 +414,141 @@ void Typer::PropagateTypes( ILControlFlowGraph& cfg )
 	cell_t pc = cfg.Entry().pc();
 	const SmxFunction* func = smx_->FindFunctionAt( pc );
 
-	TypePropagator propagator( func );
-	VisitAllNodes( cfg, propagator );
+	TypePropagator propagator( *smx_, func );
+	VisitDirty( cfg, propagator, PROPAGATE );
 
 	StructFinder struct_finder;
-	VisitAllNodes( cfg, struct_finder );
+	VisitDirty( cfg, struct_finder, FIND_STRUCTS );
+}
+
+// Whether the statement is still in the graph, it may have been removed from its block or its
+// block from the graph since it was marked dirty
+static bool InGraph( ILControlFlowGraph& cfg, const ILNode* stmt )
+{
+	ILBlock* bb = stmt->block();
+	if( !bb || bb->id() >= cfg.num_blocks() || &cfg.block( bb->id() ) != bb )
+		return false;
+
+	assert( bb->node( stmt->index() ) == stmt );
+	return true;
 }
 
-void Typer::VisitAllNodes( ILControlFlowGraph& cfg, ILVisitor& visitor )
+void Typer::VisitDirty( ILControlFlowGraph& cfg, TyperVisitor& visitor, Pass pass )
 {
-	for( size_t i = 0; i < cfg.num_blocks(); i++ )
+	// Revisiting a statement where nothing changed can't change anything either, so only the dirty
+	// statements are visited. They are still visited in program order, statements that get dirtied
+	// further down are picked up by this same pass like they would be in a full walk
+	std::vector<ILNode*>& dirty = dirty_[pass];
+	if( !seeded_[pass] )
 	{
-		ILBlock& bb = cfg.block( i );
-		for( size_t node = 0; node < bb.num_nodes(); node++ )
+		for( size_t i = 0; i < cfg.num_blocks(); i++ )
 		{
-			bb.node( node )->Accept( &visitor );
+			ILBlock& bb = cfg.block( i );
+			for( size_t node = 0; node < bb.num_nodes(); node++ )
+				dirty.push_back( bb.node( node ) );
+		}
+		seeded_[pass] = true;
+	}
+
+	cfg.TakeDirty( changed_ );
+	for( ILNode* node : changed_ )
+		MarkDirty( node );
+
+	// Statements don't move while a pass runs, so their positions are looked up once. Removed
+	// statements are dropped here
+	ordered_.clear();
+	for( ILNode* stmt : dirty )
+	{
+		if( InGraph( cfg, stmt ) )
+			ordered_.push_back( { stmt->block()->id(), stmt->index(), stmt } );
+	}
+	dirty.clear();
+	if( !std::is_sorted( ordered_.begin(), ordered_.end() ) )
+		std::sort( ordered_.begin(), ordered_.end() );
+
+	auto after = []( const DirtyStatement& a, const DirtyStatement& b ) { return b < a; };
+	later_.clear();
+
+	size_t next = 0;
+	size_t num_kept = 0;
+	bool visited = false;
+	DirtyStatement curr = {};
+	DirtyStatement last = {};
+	while( next < ordered_.size() || !later_.empty() )
+	{
+		if( !later_.empty() && ( next == ordered_.size() || later_.front() < ordered_[next] ) )
+		{
+			std::pop_heap( later_.begin(), later_.end(), after );
+			curr = later_.back();
+			later_.pop_back();
+		}
+		else
+		{
+			curr = ordered_[next++];
+		}
+
+		// A statement can be on the list more than once
+		if( visited && !( last < curr ) )
+			continue;
+		last = curr;
+		visited = true;
+
+		curr.stmt->Accept( &visitor );
+
+		for( ILNode* changed : visitor.changed_nodes() )
+			MarkDirty( changed );
+		visitor.changed_nodes().clear();
+
+		// Statements dirtied at or before this one have to wait for the next time this pass runs
+		for( size_t i = num_kept; i < dirty.size(); i++ )
+		{
+			ILNode* stmt = dirty[i];
+			if( !InGraph( cfg, stmt ) )
+				continue;
+
+			DirtyStatement entry = { stmt->block()->id(), stmt->index(), stmt };
+			if( curr < entry )
+			{
+				later_.push_back( entry );
+				std::push_heap( later_.begin(), later_.end(), after );
+			}
+			else
+			{
+				dirty[num_kept++] = stmt;
+			}
+		}
+		dirty.resize( num_kept );
+	}
+
+	num_changes_ += visitor.num_changes();
+}
+
+void Typer::MarkDirty( ILNode* node )
+{
+	// Follow the uses up to every statement that contains this node
+	walk_epoch_++;
+	walk_.clear();
+	walk_.push_back( node );
+	node->Mark( walk_epoch_ );
+	while( !walk_.empty() )
+	{
+		ILNode* curr = walk_.back();
+		walk_.pop_back();
+
+		if( curr->block() )
+		{
+			for( auto& dirty : dirty_ )
+				dirty.push_back( curr );
+		}
+
+		for( size_t i = 0; i < curr->num_uses(); i++ )
+		{
+			ILNode* use = curr->use( i );
+			if( !use->IsMarked( walk_epoch_ ) )
+			{
+				use->Mark( walk_epoch_ );
+				walk_.push_back( use );
+			}
 		}
 	}
 }
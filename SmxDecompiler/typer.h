@@ -3,6 +3,8 @@
 #include "il.h"
 #include "il-cfg.h"
 
+#include <vector>
+
 class Typer
 {
 public:
@@ -10,9 +12,48 @@ public:
 
 	void PopulateTypes( ILControlFlowGraph& cfg );
 	void PropagateTypes( ILControlFlowGraph& cfg );
+
+	// Total number of changes made to the IL by this typer, used to detect a fixpoint
+	size_t num_changes() const { return num_changes_; }
 private:
+	enum Pass
+	{
+		FILL_SMX_VARS,
+		FIND_STRUCTS,
+		PROPAGATE,
+		NUM_PASSES
+	};
+
+	// A dirty statement and where it is in the graph, statements are visited in this order
+	struct DirtyStatement
+	{
+		size_t block;
+		size_t index;
+		ILNode* stmt;
+
+		bool operator<( const DirtyStatement& other ) const
+		{
+			return block < other.block || ( block == other.block && index < other.index );
+		}
+	};
+
 	void FillSmxVars( ILControlFlowGraph& cfg, const SmxFunction* func );
-	void VisitAllNodes( ILControlFlowGraph& cfg, ILVisitor& visitor );
+	void VisitDirty( ILControlFlowGraph& cfg, class TyperVisitor& visitor, Pass pass );
+	void MarkDirty( ILNode* node );
 private:
 	SmxFile* smx_;
-};
\ No newline at end of file
+	size_t num_changes_ = 0;
+
+	// Statements (top level nodes of a block) that contain a node changed since each pass last
+	// visited them, in any order and possibly more than once. Every statement is dirty before a
+	// pass runs for the first time
+	std::vector<ILNode*> dirty_[NUM_PASSES];
+	bool seeded_[NUM_PASSES] = {};
+	// Dirty statements of the running pass: the ones it started with in order, and a heap of the
+	// ones that got dirtied further down while it runs
+	std::vector<DirtyStatement> ordered_;
+	std::vector<DirtyStatement> later_;
+	std::vector<ILNode*> changed_;
+	std::vector<ILNode*> walk_;
+	uint32_t walk_epoch_ = 0;
+};
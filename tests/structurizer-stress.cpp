@@ -0,0 +1,389 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "smx-file.h"
+#include "smx-opcodes.h"
+#include "decompiler.h"
+#include "structurizer.h"
+#include "output-buffer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+// Decompiles generated functions that are very long or very deeply nested and checks the code
+// against what the recursive statement construction wrote for them. Structuring runs on a thread
+// with a small stack. The recursive construction needed well over 256 KB for either function, so
+// it overflows that stack, while a construction that does not recurse along the statements fits.
+
+static const size_t NUM_SEQUENTIAL_IFS = 5000;
+static const size_t NESTING_DEPTH = 2000;
+static const size_t STRUCTURIZER_STACK_SIZE = 64 * 1024;
+
+// Writes the code of a plugin, with labels resolved once all of them are placed
+class Assembler
+{
+public:
+	size_t NewLabel() { labels_.push_back( 0 ); return labels_.size() - 1; }
+	void Bind( size_t label ) { labels_[label] = pc(); }
+	cell_t LabelAddress( size_t label ) const { return labels_[label]; }
+	cell_t pc() const { return (cell_t)( cells_.size() * sizeof( cell_t ) ); }
+
+	void Emit( SmxOpcode op, std::initializer_list<cell_t> args = {} )
+	{
+		cells_.push_back( op );
+		cells_.insert( cells_.end(), args.begin(), args.end() );
+	}
+	void EmitJump( SmxOpcode op, size_t label )
+	{
+		cells_.push_back( op );
+		fixups_.emplace_back( cells_.size(), label );
+		cells_.push_back( 0 );
+	}
+
+	std::vector<cell_t> Resolve() const
+	{
+		std::vector<cell_t> cells = cells_;
+		for( auto [cell, label] : fixups_ )
+			cells[cell] = labels_[label];
+		return cells;
+	}
+private:
+	std::vector<cell_t> cells_;
+	std::vector<cell_t> labels_;
+	std::vector<std::pair<size_t, size_t>> fixups_;
+};
+
+struct TestFunction
+{
+	std::string name;
+	size_t start;
+	size_t end;
+	// Raw rtti signature: argument count, return type and argument types
+	std::vector<uint8_t> signature;
+};
+
+static const uint8_t CB_INT = 0x06;
+static const uint8_t CB_VOID = 0x70;
+
+static void Append8( std::string& out, uint8_t value ) { out.push_back( (char)value ); }
+static void Append16( std::string& out, uint16_t value ) { out.append( (const char*)&value, sizeof( value ) ); }
+static void Append32( std::string& out, uint32_t value ) { out.append( (const char*)&value, sizeof( value ) ); }
+
+// Lays out an uncompressed plugin with the code, its public functions and their rtti signatures,
+// and the natives they call
+static std::string BuildPlugin( const Assembler& code, const std::vector<TestFunction>& funcs,
+	const std::vector<std::string>& natives )
+{
+	std::string names;
+	auto add_name = [&names]( const std::string& name ) {
+		uint32_t offset = (uint32_t)names.size();
+		names.append( name.c_str(), name.size() + 1 );
+		return offset;
+	};
+
+	std::string publics, rtti_data, methods;
+	Append32( methods, 12 ); // header size
+	Append32( methods, 16 ); // row size
+	Append32( methods, (uint32_t)funcs.size() );
+	for( const TestFunction& func : funcs )
+	{
+		uint32_t name = add_name( func.name );
+		Append32( publics, code.LabelAddress( func.start ) );
+		Append32( publics, name );
+
+		Append32( methods, name );
+		Append32( methods, code.LabelAddress( func.start ) );
+		Append32( methods, code.LabelAddress( func.end ) );
+		Append32( methods, (uint32_t)rtti_data.size() );
+		rtti_data.append( func.signature.begin(), func.signature.end() );
+	}
+
+	std::string native_names;
+	for( const std::string& native : natives )
+		Append32( native_names, add_name( native ) );
+
+	std::vector<cell_t> cells = code.Resolve();
+	std::string code_section;
+	Append32( code_section, (uint32_t)( cells.size() * sizeof( cell_t ) ) );
+	Append8( code_section, sizeof( cell_t ) );
+	Append8( code_section, 13 ); // code version
+	Append16( code_section, 0 ); // flags
+	Append32( code_section, 0 ); // main
+	Append32( code_section, 20 ); // code offset
+	Append32( code_section, 0 ); // features
+	code_section.append( (const char*)cells.data(), cells.size() * sizeof( cell_t ) );
+
+	std::string data_section;
+	Append32( data_section, 64 ); // data size
+	Append32( data_section, 64 + 4096 ); // memory size
+	Append32( data_section, 12 ); // data offset
+	data_section.append( 64, '\0' );
+
+	const std::pair<const char*, const std::string*> sections[] = {
+		{ ".code", &code_section },
+		{ ".data", &data_section },
+		{ ".names", &names },
+		{ ".publics", &publics },
+		{ ".natives", &native_names },
+		{ "rtti.data", &rtti_data },
+		{ "rtti.methods", &methods }
+	};
+	const size_t num_sections = sizeof( sections ) / sizeof( sections[0] );
+
+	std::string section_names;
+	std::vector<uint32_t> name_offsets;
+	for( auto [name, section] : sections )
+	{
+		name_offsets.push_back( (uint32_t)section_names.size() );
+		section_names.append( name, strlen( name ) + 1 );
+	}
+
+	const size_t header_size = 24;
+	size_t string_table = header_size + 12 * num_sections;
+	size_t body_start = string_table + section_names.size();
+
+	std::string table, body;
+	for( size_t i = 0; i < num_sections; i++ )
+	{
+		Append32( table, name_offsets[i] );
+		Append32( table, (uint32_t)( body_start + body.size() ) );
+		Append32( table, (uint32_t)sections[i].second->size() );
+		body += *sections[i].second;
+		while( body.size() % 4 )
+			body.push_back( '\0' );
+	}
+
+	uint32_t total = (uint32_t)( body_start + body.size() );
+	std::string image;
+	Append32( image, 0x53504646 ); // magic
+	Append16( image, 0x0102 ); // version
+	Append8( image, 0 ); // no compression
+	Append32( image, total ); // disk size
+	Append32( image, total ); // image size
+	Append8( image, (uint8_t)num_sections );
+	Append32( image, (uint32_t)string_table );
+	Append32( image, total ); // data offset
+	return image + table + section_names + body;
+}
+
+// int seq(int arg1) with a long run of ifs one after the other
+static void EmitSequentialIfs( Assembler& code, std::vector<TestFunction>& funcs, std::string& expected )
+{
+	TestFunction func = { "seq", code.NewLabel(), code.NewLabel(), { 1, CB_INT, CB_INT } };
+	code.Bind( func.start );
+	code.Emit( SMX_OP_PROC );
+	code.Emit( SMX_OP_BREAK );
+	code.Emit( SMX_OP_PUSH_C, { 0 } );
+	expected += "public int seq(int arg1)\n{\n  int local_4 = 0;\n";
+	for( size_t i = 0; i < NUM_SEQUENTIAL_IFS; i++ )
+	{
+		size_t skip = code.NewLabel();
+		code.Emit( SMX_OP_LOAD_S_PRI, { 12 } );
+		code.Emit( SMX_OP_CONST_ALT, { (cell_t)i } );
+		code.EmitJump( SMX_OP_JSGEQ, skip );
+		code.Emit( SMX_OP_PUSH_S, { -4 } );
+		code.Emit( SMX_OP_SYSREQ_N, { 0, 1 } );
+		code.Emit( SMX_OP_INC_S, { -4 } );
+		code.Bind( skip );
+		code.Emit( SMX_OP_PUSH_C, { (cell_t)i } );
+		code.Emit( SMX_OP_SYSREQ_N, { 0, 1 } );
+
+		std::string n = std::to_string( i );
+		expected += "  if (arg1 < " + n + ")\n  {\n    PrintToServer(local_4);\n    ++local_4;\n  }\n";
+		expected += "  PrintToServer(" + n + ");\n";
+	}
+	code.Emit( SMX_OP_LOAD_S_PRI, { -4 } );
+	code.Emit( SMX_OP_STACK, { 4 } );
+	code.Emit( SMX_OP_RETN );
+	code.Bind( func.end );
+	expected += "  return local_4;\n}\n\n";
+	funcs.push_back( func );
+}
+
+// void deep(int arg1) with ifs nested inside each other, all of them ending at the same return
+static void EmitNestedIfs( Assembler& code, std::vector<TestFunction>& funcs, std::string& expected )
+{
+	TestFunction func = { "deep", code.NewLabel(), code.NewLabel(), { 1, CB_VOID, CB_INT } };
+	code.Bind( func.start );
+	code.Emit( SMX_OP_PROC );
+	code.Emit( SMX_OP_BREAK );
+	expected += "public void deep(int arg1)\n{\n";
+	std::vector<size_t> ends;
+	for( size_t i = 0; i < NESTING_DEPTH; i++ )
+	{
+		ends.push_back( code.NewLabel() );
+		code.Emit( SMX_OP_LOAD_S_PRI, { 12 } );
+		code.Emit( SMX_OP_CONST_ALT, { (cell_t)i } );
+		code.EmitJump( SMX_OP_JSLEQ, ends.back() );
+		code.Emit( SMX_OP_PUSH_C, { (cell_t)i } );
+		code.Emit( SMX_OP_SYSREQ_N, { 0, 1 } );
+
+		std::string indent( 2 * ( i + 1 ), ' ' );
+		expected += indent + "if (arg1 > " + std::to_string( i ) + ")\n" + indent + "{\n";
+		expected += indent + "  PrintToServer(" + std::to_string( i ) + ");\n";
+	}
+	for( size_t label : ends )
+		code.Bind( label );
+	for( size_t i = NESTING_DEPTH; i > 0; i-- )
+		expected += std::string( 2 * i, ' ' ) + "}\n";
+	code.Emit( SMX_OP_ZERO_PRI );
+	code.Emit( SMX_OP_RETN );
+	code.Bind( func.end );
+	expected += "  return;\n}\n\n";
+	funcs.push_back( func );
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadMain( LPVOID param )
+{
+	( *static_cast<const std::function<void()>*>( param ) )();
+	return 0;
+}
+#else
+static void* ThreadMain( void* param )
+{
+	( *static_cast<const std::function<void()>*>( param ) )();
+	return nullptr;
+}
+#endif
+
+// Runs func on a thread of its own that gets no more than stack_size bytes of stack, and waits for it
+static bool RunWithStack( size_t stack_size, const std::function<void()>& func )
+{
+#ifdef _WIN32
+	HANDLE thread = CreateThread( nullptr, stack_size, ThreadMain, (LPVOID)&func, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr );
+	if( !thread )
+		return false;
+	WaitForSingleObject( thread, INFINITE );
+	CloseHandle( thread );
+	return true;
+#else
+	pthread_attr_t attr;
+	pthread_attr_init( &attr );
+	pthread_attr_setstacksize( &attr, stack_size < (size_t)PTHREAD_STACK_MIN ? (size_t)PTHREAD_STACK_MIN : stack_size );
+	pthread_t thread;
+	bool started = pthread_create( &thread, &attr, ThreadMain, (void*)&func ) == 0;
+	pthread_attr_destroy( &attr );
+	if( started )
+		pthread_join( thread, nullptr );
+	return started;
+#endif
+}
+
+static unsigned long CurrentProcessId()
+{
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return (unsigned long)getpid();
+#endif
+}
+
+// Points out the first line where the code differs from what was expected
+static void ReportMismatch( const std::string& code, const std::string& expected )
+{
+	size_t line = 1, pos = 0;
+	while( pos < code.size() && pos < expected.size() && code[pos] == expected[pos] )
+	{
+		if( code[pos] == '\n' )
+			line++;
+		pos++;
+	}
+	size_t line_start = expected.rfind( '\n', pos ? pos - 1 : 0 );
+	line_start = line_start == std::string::npos || pos == 0 ? 0 : line_start + 1;
+	auto line_at = [line_start]( const std::string& text ) {
+		if( line_start >= text.size() )
+			return std::string( "<end of code>" );
+		return text.substr( line_start, text.find( '\n', line_start ) - line_start );
+	};
+	std::cerr << "  line " << line << ": got \"" << line_at( code ) << "\", expected \"" << line_at( expected ) << "\"\n";
+}
+
+static bool CheckFunction( SmxFile& smx, const char* name, StructurizerEngine engine, const std::string& expected )
+{
+	SmxFunction* func = smx.FindFunctionByName( name );
+	if( !func )
+	{
+		std::cerr << name << ": not found in the plugin\n";
+		return false;
+	}
+
+	ILNodePool nodes;
+	ILNodePool::Scope use_nodes( nodes );
+	std::unique_ptr<ILControlFlowGraph> ilcfg( BuildIL( smx, *func, nullptr ) );
+
+	Structurizer structurizer( ilcfg.get(), engine );
+	Statement* func_stmt = nullptr;
+	bool ran = RunWithStack( STRUCTURIZER_STACK_SIZE, [&]() {
+		ILNodePool::Scope use_nodes_on_thread( nodes );
+		func_stmt = structurizer.Transform();
+	} );
+	if( !ran )
+	{
+		std::cerr << name << ": could not start the structurizer thread\n";
+		return false;
+	}
+
+	OutputBuffer out;
+	WriteFunction( smx, *func, func_stmt, out );
+	std::string code = out.str();
+
+	const char* engine_name = engine == StructurizerEngine::INTERVALS ? "intervals" : "regions";
+	if( code != expected )
+	{
+		std::cerr << name << " (" << engine_name << "): code differs\n";
+		ReportMismatch( code, expected );
+		return false;
+	}
+
+	std::cout << name << " (" << engine_name << "): ok\n";
+	return true;
+}
+
+int main()
+{
+	Assembler code;
+	std::vector<TestFunction> funcs;
+	std::string expected_seq, expected_deep;
+	code.Emit( SMX_OP_HALT, { 0 } );
+	EmitSequentialIfs( code, funcs, expected_seq );
+	EmitNestedIfs( code, funcs, expected_deep );
+	code.Emit( SMX_OP_ENDPROC );
+
+	std::string image = BuildPlugin( code, funcs, { "PrintToServer" } );
+	// The process id keeps test runs from several build trees at once out of each other's way
+	std::string file_name = "smxdec-structurizer-stress-" + std::to_string( CurrentProcessId() ) + ".smx";
+	std::filesystem::path path = std::filesystem::temp_directory_path() / file_name;
+	if( FILE* file = fopen( path.string().c_str(), "wb" ) )
+	{
+		fwrite( image.data(), 1, image.size(), file );
+		fclose( file );
+	}
+	else
+	{
+		std::cerr << "Could not write " << path.string() << "\n";
+		return 1;
+	}
+
+	SmxFile smx( path.string().c_str() );
+	bool ok = true;
+	for( StructurizerEngine engine : { StructurizerEngine::INTERVALS, StructurizerEngine::REGIONS } )
+	{
+		ok &= CheckFunction( smx, "seq", engine, expected_seq );
+		ok &= CheckFunction( smx, "deep", engine, expected_deep );
+	}
+
+	std::filesystem::remove( path );
+	return ok ? 0 : 1;
+}